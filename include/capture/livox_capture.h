@@ -0,0 +1,174 @@
+#ifndef LOAM_HORIZON_LIVOX_CAPTURE_H
+#define LOAM_HORIZON_LIVOX_CAPTURE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/// Indexed binary capture of Livox packets, IMU samples and camera
+/// timestamps, for replaying recorded data at full CPU speed.
+///
+/// The file is a header, the records in arrival order, the index and a
+/// footer. A record is a 16 byte header and its payload, padded to 8 bytes.
+/// A lidar packet keeps its points in columns (offset_time, x, y, z,
+/// reflectivity, tag, line), so a mapped capture is read in place: no
+/// parsing and no copy, each field one contiguous array.
+/// Everything is little endian. A capture whose writer did not close it
+/// has no index; the reader then walks the records, up to the last whole one.
+enum CaptureRecordType : uint32_t {
+  kCaptureLidarPacket = 1,
+  kCaptureImu = 2,
+  kCaptureImageStamp = 3
+};
+
+struct CaptureRecordHeader {
+  uint32_t type;
+  /// Payload bytes, padding included
+  uint32_t size;
+  /// Packet timebase, or message stamp
+  uint64_t stamp_ns;
+};
+
+struct CaptureImuSample {
+  double angular_velocity[3];
+  double linear_acceleration[3];
+};
+
+/// One record of the index
+struct CaptureIndexEntry {
+  uint64_t offset;
+  uint64_t stamp_ns;
+  uint32_t type;
+  /// Points of a packet, the camera of an image stamp
+  uint32_t count;
+};
+
+/// The columns of a packet, pointing into the mapped file
+struct CapturePacket {
+  uint64_t timebase;
+  uint32_t point_num;
+  /// Input lidar, as numbered by the recorder
+  uint8_t lidar;
+  const uint32_t *offset_time;
+  const float *x, *y, *z;
+  const uint8_t *reflectivity, *tag, *line;
+};
+
+class CaptureWriter {
+ public:
+  CaptureWriter() = default;
+  ~CaptureWriter() { Close(); }
+  CaptureWriter(const CaptureWriter &) = delete;
+  CaptureWriter &operator=(const CaptureWriter &) = delete;
+
+  bool Open(const std::string &path);
+  /// Writes the index; the capture is readable without it, only slower
+  bool Close();
+
+  /// Point is anything with the fields of livox_ros_driver::CustomPoint
+  template <typename Point>
+  void AddPacket(uint8_t lidar, uint64_t timebase, const Point *points,
+                 uint32_t point_num);
+  void AddImu(uint64_t stamp_ns, const CaptureImuSample &sample);
+  void AddImageStamp(uint64_t stamp_ns, uint32_t camera);
+
+  /// Records written so far
+  size_t size() const { return index_.size(); }
+  const std::string &error() const { return error_; }
+
+ private:
+  void WriteRecord(uint32_t type, uint64_t stamp_ns, uint32_t count,
+                   const std::vector<uint8_t> &payload);
+
+  std::FILE *file_ = nullptr;
+  uint64_t offset_ = 0;
+  std::vector<CaptureIndexEntry> index_;
+  /// Payload of the record being written, reused
+  std::vector<uint8_t> payload_;
+  std::string error_;
+};
+
+class CaptureReader {
+ public:
+  CaptureReader() = default;
+  ~CaptureReader() { Close(); }
+  CaptureReader(const CaptureReader &) = delete;
+  CaptureReader &operator=(const CaptureReader &) = delete;
+
+  /// Maps the file, it stays mapped until Close()
+  bool Open(const std::string &path);
+  void Close();
+
+  size_t size() const { return index_.size(); }
+  const CaptureIndexEntry &entry(size_t i) const { return index_[i]; }
+
+  /// The record i, false if it has an other type
+  bool Packet(size_t i, CapturePacket *packet) const;
+  bool Imu(size_t i, CaptureImuSample *sample) const;
+
+  /// Whether the index had to be rebuilt, the capture was not closed
+  bool recovered() const { return recovered_; }
+  const std::string &error() const { return error_; }
+
+ private:
+  bool ReadIndex();
+  void ScanRecords();
+  const uint8_t *Payload(size_t i) const {
+    return data_ + index_[i].offset + sizeof(CaptureRecordHeader);
+  }
+
+  const uint8_t *data_ = nullptr;
+  size_t length_ = 0;
+  std::vector<CaptureIndexEntry> index_;
+  bool recovered_ = false;
+  std::string error_;
+};
+
+/// Bytes of a column of n elements of T, padded to 8
+template <typename T>
+inline size_t CaptureColumnBytes(uint32_t n) {
+  return (n * sizeof(T) + 7) & ~size_t(7);
+}
+
+/// Payload bytes of a packet of n points
+inline size_t CapturePacketBytes(uint32_t n) {
+  return 16 + CaptureColumnBytes<uint32_t>(n) +
+         3 * CaptureColumnBytes<float>(n) + 3 * CaptureColumnBytes<uint8_t>(n);
+}
+
+template <typename Point>
+void CaptureWriter::AddPacket(uint8_t lidar, uint64_t timebase,
+                              const Point *points, uint32_t point_num) {
+  payload_.assign(CapturePacketBytes(point_num), 0);
+  uint8_t *p = payload_.data();
+  /// timebase, point_num, lidar, padding
+  std::memcpy(p, &timebase, 8);
+  std::memcpy(p + 8, &point_num, 4);
+  p[12] = lidar;
+  p += 16;
+
+  uint32_t *offset_time = reinterpret_cast<uint32_t *>(p);
+  p += CaptureColumnBytes<uint32_t>(point_num);
+  float *xyz[3];
+  for (auto &column : xyz) {
+    column = reinterpret_cast<float *>(p);
+    p += CaptureColumnBytes<float>(point_num);
+  }
+  uint8_t *reflectivity = p;
+  uint8_t *tag = reflectivity + CaptureColumnBytes<uint8_t>(point_num);
+  uint8_t *line = tag + CaptureColumnBytes<uint8_t>(point_num);
+  for (uint32_t i = 0; i < point_num; i++) {
+    offset_time[i] = points[i].offset_time;
+    xyz[0][i] = points[i].x;
+    xyz[1][i] = points[i].y;
+    xyz[2][i] = points[i].z;
+    reflectivity[i] = points[i].reflectivity;
+    tag[i] = points[i].tag;
+    line[i] = points[i].line;
+  }
+  WriteRecord(kCaptureLidarPacket, timebase, point_num, payload_);
+}
+
+#endif  // LOAM_HORIZON_LIVOX_CAPTURE_H
@@ -0,0 +1,46 @@
+#ifndef LOAM_HORIZON_CURVATURE_KERNEL_H
+#define LOAM_HORIZON_CURVATURE_KERNEL_H
+
+/// Half window of the curvature sum, and the one used once a far point is met
+constexpr int kNumCurvSize = 5;
+constexpr int kNumCurvSizeFar = 2;
+constexpr float kDistanceFaraway = 25;
+/// Points at the ends of a scan left out of the curvature, whatever the
+/// window: the first and the last kCurvatureMargin
+constexpr int kCurvatureMargin = 5;
+
+/// Label of points too close / too far / invalid to be a feature
+constexpr int kLabelUnreliable = 99;
+
+/// Computes, in one pass over a structure-of-arrays copy of the scan
+/// (x, y, z of n points), for every point in
+/// [kCurvatureMargin, n - kCurvatureMargin):
+///   - curvature: squared norm of the window sum, or its normalized root,
+///   - label: 0, or kLabelUnreliable for invalid ranges,
+///   - neighbor_picked: 1 for unreliable, occluded and parallel-beam points.
+/// As in the original front end, the window shrinks from kNumCurvSize to
+/// kNumCurvSizeFar for the rest of the frame once a point is farther than
+/// kDistanceFaraway. Returns the window size in use at the end of the frame.
+///
+/// Uses AVX2 or NEON when compiled for it; results are bit-identical to the
+/// scalar code as long as the file is built with -ffp-contract=off.
+/// specialized runs the kernels compiled for kNumCurvSize and
+/// kNumCurvSizeFar, whose window sums are unrolled, and the generic kernel
+/// for any other window; false runs the generic one throughout. Both give
+/// the same results.
+int ComputeCurvature(const float *x, const float *y, const float *z, int n,
+                     bool normalize, float *curvature, int *neighbor_picked,
+                     int *label, bool specialized = true);
+
+/// The same for the points in [begin, end) only, entering with window *win
+/// and leaving it as it is after end. Points at or after occlusion_end skip
+/// the occlusion test, as the last ones of a frame do. x, y, z must be
+/// readable kNumCurvSize points around the range. Lets a frame be computed
+/// piecewise as it arrives with the result of ComputeCurvature.
+void ComputeCurvatureRange(const float *x, const float *y, const float *z,
+                           int begin, int end, int occlusion_end,
+                           bool normalize, int *win, float *curvature,
+                           int *neighbor_picked, int *label,
+                           bool specialized = true);
+
+#endif  // LOAM_HORIZON_CURVATURE_KERNEL_H
@@ -0,0 +1,65 @@
+#ifndef LOAM_HORIZON_FEATURE_BUDGET_H
+#define LOAM_HORIZON_FEATURE_BUDGET_H
+
+#include "feature_extractor/feature_extractor.h"
+
+struct FeatureBudgetConfig {
+  /// Latency to hold for one frame: extraction + odometry + mapping, in ms
+  double target_ms = 60;
+  /// Bounds of the per-region quotas
+  FeatureQuota min_quota{1, 8, 2};
+  FeatureQuota max_quota{4, 40, 8};
+  /// Fraction of the relative latency error applied per frame
+  double gain = 0.1;
+  /// Relative error below which the quotas are left alone
+  double deadband = 0.05;
+  /// Weight of the newest sample in the smoothed stage latencies
+  double smoothing = 0.2;
+};
+
+/// Scales the feature quotas to hold a latency target. The downstream cost
+/// grows with the number of features, so the quotas are the base quota
+/// times one common scale, which a proportional step moves towards the
+/// target every frame. With a scale of 1 the base quota is used as is.
+class FeatureBudgetController {
+ public:
+  FeatureBudgetController(const FeatureBudgetConfig &config,
+                          const FeatureQuota &base_quota);
+
+  /// Latest per-frame times of the stages, in ms. A stage that never
+  /// reports counts as 0.
+  void ReportExtraction(double ms) { Smooth(ms, &extraction_ms_); }
+  void ReportOdometry(double ms) { Smooth(ms, &odometry_ms_); }
+  void ReportMapping(double ms) { Smooth(ms, &mapping_ms_); }
+
+  /// Moves the scale one step, returns the quotas for the next frame
+  const FeatureQuota &Update();
+
+  const FeatureQuota &quota() const { return quota_; }
+  double latency_ms() const {
+    return extraction_ms_.ms + odometry_ms_.ms + mapping_ms_.ms;
+  }
+  double scale() const { return scale_; }
+
+ private:
+  /// Smoothed time of a stage, 0 until its first report
+  struct StageTime {
+    double ms = 0;
+    bool initialized = false;
+  };
+
+  void Smooth(double ms, StageTime *smoothed) const;
+  int Scaled(int base, int min_num, int max_num) const;
+
+  FeatureBudgetConfig config_;
+  FeatureQuota base_quota_;
+  FeatureQuota quota_;
+  double scale_ = 1;
+  double min_scale_, max_scale_;
+
+  StageTime extraction_ms_;
+  StageTime odometry_ms_;
+  StageTime mapping_ms_;
+};
+
+#endif  // LOAM_HORIZON_FEATURE_BUDGET_H
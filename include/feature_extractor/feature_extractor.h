@@ -0,0 +1,188 @@
+#ifndef LOAM_HORIZON_FEATURE_EXTRACTOR_H
+#define LOAM_HORIZON_FEATURE_EXTRACTOR_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "feature_extractor/voxel_filter.h"
+#include "loam_horizon/common.h"
+#include "loam_horizon/thread_pool.h"
+
+/// The four feature clouds of one frame
+struct FeatureSet {
+  PointCloudXYZI corner_sharp;
+  PointCloudXYZI corner_less_sharp;
+  PointCloudXYZI surf_flat;
+  PointCloudXYZI surf_less_flat;
+
+  /// The same features as indices into the input points, in the same order
+  std::vector<uint32_t> corner_sharp_ind;
+  std::vector<uint32_t> corner_less_sharp_ind;
+  std::vector<uint32_t> surf_flat_ind;
+  std::vector<uint32_t> surf_less_flat_ind;
+
+  void clear();
+};
+
+/// Features picked per region, at most
+struct FeatureQuota {
+  int num_edge = 2;
+  /// Including the edge points
+  int num_less_edge = 20;
+  int num_flat = 4;
+};
+
+struct FeatureExtractorConfig {
+  /// Thresholds of the normalized curvature
+  float threshold_sharp = 0.01;
+  float threshold_flat = 0.01;
+  bool normalize_curv = true;
+
+  FeatureQuota quota;
+
+  /// Whether downsample less-flat points, and the leaf size to use. The
+  /// first point of a voxel is kept, so the features stay input points.
+  bool downsample_less_flat = false;
+  float less_flat_leaf_size = 0.2;
+
+  /// Threads extracting scan lines concurrently, 1 for serial. The output
+  /// does not depend on it.
+  int num_threads = 1;
+
+  /// Curvature kernels unrolled for the near / far window sizes, false runs
+  /// the generic one. The output does not depend on it.
+  bool specialized_kernels = true;
+
+  /// debug
+  bool only_first_scan = false;
+};
+
+/// Curvature based edge / plane feature extraction of a multi-line scan.
+/// Holds no ROS state; the per-point workspace grows to the largest frame
+/// seen and is reused afterwards, so one extractor per thread is enough.
+///
+/// Scan lines are independent once the curvature is known: the regions and
+/// their +-5 neighbor marking stay inside [line start + 5, line end - 6].
+/// Lines can therefore be extracted on a thread pool, their features are
+/// merged in line order afterwards so the result equals the serial one.
+class FeatureExtractor {
+ public:
+  FeatureExtractor() = default;
+  explicit FeatureExtractor(const FeatureExtractorConfig &config);
+
+  void set_config(const FeatureExtractorConfig &config);
+  void set_quota(const FeatureQuota &quota) { config_.quota = quota; }
+  const FeatureExtractorConfig &config() const { return config_; }
+
+  /// points: the scan lines one after the other, line_size[i] points each.
+  /// Features of the frame are written to *features (cleared first).
+  void Extract(const PointType *points, const std::vector<int> &line_size,
+               FeatureSet *features);
+
+  /// Streaming input, for frames that arrive in packets: BeginFrame()
+  /// starts a frame, AppendPoint() adds a point to the end of its line and
+  /// Update(), called once per packet, computes the curvature of every point
+  /// whose window is complete. FinishFrame() lays the lines out one after
+  /// the other in *cloud, computes the few points left (the line ends, and
+  /// the points a far point of an earlier line switches to the small
+  /// window) and extracts the features. *cloud, *line_size and *features
+  /// are then the same as IngestScan + Extract of the whole frame.
+  void BeginFrame(int num_lines);
+  void AppendPoint(int line, const PointType &pt);
+  void Update();
+  void FinishFrame(PointCloudXYZI *cloud, std::vector<int> *line_size,
+                   FeatureSet *features);
+
+  /// Per-point results of the last frame
+  /// label: -1: flat, 0: less-flat, 1:less-edge, 2:edge, 99: un-reliable
+  const std::vector<float> &curvature() const { return curvature_; }
+  const std::vector<int> &label() const { return label_; }
+  const std::vector<int> &neighbor_picked() const { return neighbor_picked_; }
+
+  /// Time spent ordering candidates in the last frame, in ms
+  double sort_time() const { return t_q_sort_; }
+
+ private:
+  struct CurvatureLess {
+    const float *curv;
+    bool operator()(int i, int j) const {
+      return curv[i] < curv[j] || (curv[i] == curv[j] && i < j);
+    }
+  };
+  struct CurvatureGreater {
+    const float *curv;
+    bool operator()(int i, int j) const {
+      return CurvatureLess{curv}(j, i);
+    }
+  };
+
+  /// Features of one scan line, before merging
+  struct LineFeatures {
+    bool valid = false;
+    PointCloudXYZI corner_sharp;
+    PointCloudXYZI corner_less_sharp;
+    PointCloudXYZI surf_flat;
+    PointCloudXYZI::Ptr less_flat_scan{new PointCloudXYZI()};
+    PointCloudXYZI less_flat_scan_ds;
+    std::vector<uint32_t> less_flat_scan_ds_ind;
+    /// Per line, lines are downsampled concurrently
+    VoxelFilter less_flat_filter{VoxelFilter::kFirstPoint};
+    std::vector<int> first;
+    std::vector<uint32_t> corner_sharp_ind;
+    std::vector<uint32_t> corner_less_sharp_ind;
+    std::vector<uint32_t> surf_flat_ind;
+    std::vector<uint32_t> less_flat_scan_ind;
+    std::vector<float> peak_curv;
+    double t_q_sort = 0;
+  };
+
+  /// One scan line of a streamed frame, in its own index space
+  struct LineStream {
+    PointCloudXYZI points;
+    std::vector<float> x, y, z;
+    /// Results of the points in [5, done)
+    std::vector<float> curvature;
+    std::vector<int> neighbor_picked;
+    std::vector<int> label;
+    int done = 5;
+    /// Window in use at done, as if the line started the frame, and the
+    /// first point that switched it (INT_MAX if none)
+    int win = 5;
+    int first_far = 0;
+  };
+
+  /// Sizes the workspace and the line bounds, returns the number of points
+  int Layout(const std::vector<int> &line_size);
+  /// Everything after the curvature
+  void ExtractLines(const PointType *points, const std::vector<int> &line_size,
+                    int curv_size, FeatureSet *features);
+  static int FirstFar(const LineStream &line, int begin, int end);
+
+  void ExtractLine(const PointType *points, int start, int end,
+                   LineFeatures *line);
+  void ExtractRegion(const PointType *points, int sp, int ep,
+                     LineFeatures *line);
+  bool IsIsolatedPeak(int sp, int ep, int max_ind,
+                      std::vector<float> *peak_curv);
+  template <int kNum>
+  void MarkNeighbors(int ind);
+
+  FeatureExtractorConfig config_;
+  std::unique_ptr<ThreadPool> pool_;
+
+  /// Workspace, sized to the current frame
+  std::vector<float> x_, y_, z_;
+  std::vector<float> curvature_;
+  std::vector<int> sort_ind_;
+  std::vector<int> neighbor_picked_;
+  std::vector<int> label_;
+  std::vector<int> scan_start_ind_, scan_end_ind_;
+  std::vector<LineFeatures> lines_;
+  std::vector<LineStream> streams_;
+  int num_stream_lines_ = 0;
+
+  double t_q_sort_ = 0;
+};
+
+#endif  // LOAM_HORIZON_FEATURE_EXTRACTOR_H
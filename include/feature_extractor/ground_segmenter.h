@@ -0,0 +1,59 @@
+#ifndef LOAM_HORIZON_GROUND_SEGMENTER_H
+#define LOAM_HORIZON_GROUND_SEGMENTER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "feature_extractor/feature_extractor.h"
+#include "feature_extractor/range_image.h"
+#include "loam_horizon/common.h"
+
+struct GroundSegmenterConfig {
+  /// Steepest slope to the point below / above that is still ground, in deg
+  float max_slope_deg = 10;
+  /// Ground is below this height in the lidar frame
+  float max_z = 0;
+  /// Rows of the range image searched for the point below / above
+  int search_rows = 10;
+  /// Ground points kept as flat features per frame, -1 keeps all
+  int max_ground_flat = 200;
+};
+
+/// Tells ground points by the slope to their vertical neighbor in the range
+/// image: a point is ground when it is low enough and the closest point a
+/// few rows below (or above) is nearly level with it. Only the candidates
+/// asked for are tested, so it costs a few cell lookups per flat feature.
+class GroundSegmenter {
+ public:
+  explicit GroundSegmenter(
+      const GroundSegmenterConfig &config = GroundSegmenterConfig());
+
+  const GroundSegmenterConfig &config() const { return config_; }
+
+  /// Whether points[index] is ground, points being the ones in image
+  bool IsGround(const PointType *points, const RangeImage &image,
+                int index) const;
+
+  /// Thins the ground points among the flat features of *features down to
+  /// max_ground_flat, keeping an evenly spread subset. The less-flat ones
+  /// keep all of them. Returns the number of flat features dropped.
+  int CapGroundFlat(const PointType *points, const RangeImage &image,
+                    FeatureSet *features);
+
+  /// Of the last frame
+  int num_ground_flat() const { return num_ground_flat_; }
+
+ private:
+  /// Closest filled cell of col in the rows from row + step on, -1 if none
+  int Vertical(const RangeImage &image, int row, int col, int step) const;
+
+  GroundSegmenterConfig config_;
+  float max_slope_tan_;
+  int num_ground_flat_ = 0;
+
+  std::vector<uint8_t> is_ground_;
+  PointCloudXYZI kept_;
+  std::vector<uint32_t> kept_ind_;
+};
+
+#endif  // LOAM_HORIZON_GROUND_SEGMENTER_H
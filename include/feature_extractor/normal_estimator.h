@@ -0,0 +1,71 @@
+#ifndef LOAM_HORIZON_NORMAL_ESTIMATOR_H
+#define LOAM_HORIZON_NORMAL_ESTIMATOR_H
+
+#include <Eigen/Core>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "feature_extractor/range_image.h"
+#include "loam_horizon/common.h"
+
+struct NormalEstimatorConfig {
+  /// Neighbors taken on each side along the scan line
+  int line_neighbors = 3;
+  /// Range image cells taken around the point, for the other lines
+  int image_radius = 2;
+  /// Neighbors farther than max(min_distance, distance_ratio * range) are
+  /// not on the same surface
+  float min_distance = 0.3;
+  float distance_ratio = 0.05;
+  /// Fewer neighbors than this, or than this from other lines, give no
+  /// normal
+  int min_neighbors = 5;
+  int min_cross_line = 2;
+};
+
+/// Local surface normal of feature points, from their neighbors along the
+/// scan line and across lines through the range image. The unit normal
+/// points to the sensor and is scaled by the planarity
+/// (lambda1 - lambda0) / lambda1 of the neighborhood covariance, in [0, 1],
+/// then stored in normal_x/y/z. A zero vector means no estimate. lambda2 is
+/// left out, neighbors along a line are much denser than across lines and
+/// would make every patch look like an edge.
+class NormalEstimator {
+ public:
+  explicit NormalEstimator(
+      const NormalEstimatorConfig &config = NormalEstimatorConfig());
+
+  /// Estimates the normals of points[indices]. points is grouped by scan
+  /// line as line_size tells, and projected into image. Returns the number
+  /// of points that got a normal.
+  int Estimate(PointType *points, const std::vector<int> &line_size,
+               const RangeImage &image, const std::vector<uint32_t> &indices);
+
+ private:
+  bool EstimateOne(PointType *points, int index, int line_start,
+                   int line_end, const RangeImage &image);
+
+  NormalEstimatorConfig config_;
+  /// First point of every line, and the end of the last one
+  std::vector<int> line_offset_;
+  std::vector<int> neighbors_;
+};
+
+/// Normal of a point scaled by its planarity, zero if it has none
+inline Eigen::Vector3f NormalOf(const PointType &pt) {
+  return Eigen::Vector3f(pt.normal_x, pt.normal_y, pt.normal_z);
+}
+
+/// Planarity of a point carrying an estimated normal, 0 if none
+inline float Planarity(const PointType &pt) { return NormalOf(pt).norm(); }
+
+/// Whether two normals are within acos(min_cos) of each other, up to the
+/// sign. A missing normal agrees with anything.
+inline bool NormalsAgree(const Eigen::Vector3f &a, const Eigen::Vector3f &b,
+                         float min_cos) {
+  const float norms = a.norm() * b.norm();
+  return norms == 0 || std::fabs(a.dot(b)) >= min_cos * norms;
+}
+
+#endif  // LOAM_HORIZON_NORMAL_ESTIMATOR_H
@@ -0,0 +1,65 @@
+#ifndef LOAM_HORIZON_RANGE_IMAGE_H
+#define LOAM_HORIZON_RANGE_IMAGE_H
+
+#include <vector>
+
+#include "loam_horizon/common.h"
+
+struct RangeImageConfig {
+  /// Horizon FOV is 81.7 x 25.1 deg, with some margin
+  float h_fov_deg = 84;
+  float v_fov_deg = 28;
+  /// Cell size, in deg
+  float resolution_deg = 0.2;
+};
+
+/// Azimuth / elevation grid of one frame, each cell holds the index of the
+/// closest point falling into it. Across scan lines this gives the
+/// neighbors of a point in O(1) instead of a kd-tree search.
+class RangeImage {
+ public:
+  explicit RangeImage(const RangeImageConfig &config = RangeImageConfig());
+
+  /// Empties the image for a frame of num_points points. Only the cells used
+  /// by the last frame are cleared, so it is O(points), not O(cells).
+  void Reset(int num_points);
+
+  /// Projects the point of the given index, false if it is out of the FOV
+  bool Insert(const PointType &pt, int index);
+
+  /// Cell of a point, false if out of the FOV
+  bool Project(const PointType &pt, int *row, int *col) const;
+
+  /// Point index of a cell, -1 if empty or out of the image
+  int At(int row, int col) const {
+    if (row < 0 || row >= rows_ || col < 0 || col >= cols_) return -1;
+    return cells_[row * cols_ + col];
+  }
+
+  /// Cell of an inserted point, false if it was not projected
+  bool CellOf(int index, int *row, int *col) const {
+    int cell = point_cell_[index];
+    if (cell < 0) return false;
+    *row = cell / cols_;
+    *col = cell % cols_;
+    return true;
+  }
+
+  /// Indices of the points in the (2 * radius + 1)^2 cells around a point,
+  /// the point itself excluded. Returns their number.
+  int Neighbors(int index, int radius, std::vector<int> *neighbors) const;
+
+  int rows() const { return rows_; }
+  int cols() const { return cols_; }
+
+ private:
+  float h_half_rad_, v_half_rad_, inv_res_rad_;
+  int rows_, cols_;
+
+  std::vector<int> cells_;
+  std::vector<float> cell_range_;
+  std::vector<int> touched_;
+  std::vector<int> point_cell_;
+};
+
+#endif  // LOAM_HORIZON_RANGE_IMAGE_H
@@ -0,0 +1,35 @@
+#ifndef LOAM_HORIZON_SCAN_INGEST_H
+#define LOAM_HORIZON_SCAN_INGEST_H
+
+#include <vector>
+
+#include "feature_extractor/range_image.h"
+#include "loam_horizon/common.h"
+
+struct LivoxPoint;
+
+/// Groups the points of a livox_repub frame by scan line, as
+/// scanRegistration ingests them before the feature extraction. Shared with
+/// the capture benchmark, so both drop and order the points the same way.
+class ScanIngest {
+ public:
+  /// Reads num_points LivoxPoints, drops NaN ones, the ones closer than
+  /// min_range and the ones on a line >= num_lines, and writes the rest into
+  /// *cloud grouped by line, in their original order: a count pass sizes
+  /// the lines, a fill pass scatters the points. image, unless null, is
+  /// reset and gets every point. Features stay PointType for odometry and
+  /// mapping: the intensity is the line plus the time offset, the
+  /// curvature the reflectivity / 10.
+  /// *cloud, *line_size and the buffers keep their capacity across frames.
+  void Ingest(const LivoxPoint *points, int num_points, int num_lines,
+              float min_range, PointCloudXYZI *cloud,
+              std::vector<int> *line_size, RangeImage *image);
+
+ private:
+  /// Line of every point, -1 if dropped
+  std::vector<int> point_line_;
+  /// Next free index of every line during the fill
+  std::vector<int> line_fill_;
+};
+
+#endif  // LOAM_HORIZON_SCAN_INGEST_H
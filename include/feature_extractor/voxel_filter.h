@@ -0,0 +1,67 @@
+#ifndef LOAM_HORIZON_VOXEL_FILTER_H
+#define LOAM_HORIZON_VOXEL_FILTER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "loam_horizon/common.h"
+
+/// Voxel grid downsampling in O(n) with an open addressing hash of the
+/// occupied voxels, a drop-in for pcl::VoxelGrid<PointType>:
+///   - no sort, and voxel coordinates are plain ints, so large extents or
+///     small leaves do not overflow a flattened index,
+///   - the table and the accumulators keep their memory across calls, a
+///     filter reused for every frame / cube allocates nothing once warm,
+///   - voxels come out in insertion order, the order their first point
+///     comes in, where pcl::VoxelGrid sorts them by voxel index: the same
+///     voxels, in another order.
+/// kCentroid averages every field like pcl::VoxelGrid does, kFirstPoint
+/// keeps the first point of each voxel as is, which is cheaper still and
+/// leaves the fields of a real point.
+class VoxelFilter {
+ public:
+  enum Policy { kCentroid, kFirstPoint };
+
+  explicit VoxelFilter(Policy policy = kCentroid) : policy_(policy) {}
+
+  void setLeafSize(float lx, float ly, float lz);
+  void setPolicy(Policy policy) { policy_ = policy; }
+  void setInputCloud(const PointCloudXYZI::ConstPtr &cloud) { input_ = cloud; }
+
+  /// Downsamples the input cloud into *output, which may not be the input
+  void filter(PointCloudXYZI &output);
+  /// The same for any range of points. If first is given, it gets the
+  /// position in points of the first point of every output voxel.
+  void Filter(const PointType *points, int n, PointCloudXYZI *output,
+              std::vector<int> *first = nullptr);
+
+ private:
+  /// 16 bytes, four to a cache line
+  struct Slot {
+    int32_t x, y, z;
+    /// Voxel number in this call, -1 if empty
+    int32_t voxel;
+  };
+  /// Running sums of one voxel
+  struct Sum {
+    float x, y, z, intensity, normal_x, normal_y, normal_z, curvature;
+    int count;
+  };
+
+  /// Voxel number of a cell, a new one is added if it is not there yet
+  int Find(int32_t x, int32_t y, int32_t z, bool *inserted);
+  void Reserve(int n);
+
+  Policy policy_;
+  float inv_leaf_[3] = {1, 1, 1};
+  PointCloudXYZI::ConstPtr input_;
+
+  std::vector<Slot> slots_;
+  uint32_t mask_ = 0;
+  /// Slots filled by the last call, emptied by the next one
+  std::vector<uint32_t> used_;
+  int num_voxels_ = 0;
+  std::vector<Sum> sums_;
+};
+
+#endif  // LOAM_HORIZON_VOXEL_FILTER_H
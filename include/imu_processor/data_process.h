@@ -9,6 +9,7 @@
 #include <fstream>
 #include "gyr_int.h"
 #include "loam_horizon/common.h"
+#include "loam_horizon/livox_point.h"
 #include "sophus/se3.hpp"
 
 struct MeasureGroup {
@@ -28,7 +29,7 @@ class ImuProcess {
 
   void IntegrateGyr(const std::vector<sensor_msgs::Imu::ConstPtr> &v_imu);
 
-  void UndistortPcl(const PointCloudXYZI::Ptr &pcl_in_out, double dt_be,
+  void UndistortPcl(const PointCloudLivox::Ptr &pcl_in_out, double dt_be,
                     const Sophus::SE3d &Tbe);
   void set_T_i_l(Eigen::Quaterniond& q, Eigen::Vector3d& t){
     T_i_l = Sophus::SE3d(q, t);
@@ -37,13 +38,18 @@ class ImuProcess {
   ros::NodeHandle nh;
 
  private:
+  /// Advertised up front, so subscribers are known from the first frame
+  ros::Publisher pub_first_point_;
+  ros::Publisher pub_undistort_;
+  ros::Publisher pub_distort_;
+
   /// Whether is the first frame, init for first frame
   bool b_first_frame_ = true;
 
   //// Input pointcloud
-  PointCloudXYZI::Ptr cur_pcl_in_;
+  PointCloudLivox::Ptr cur_pcl_in_;
   //// Undistorted pointcloud
-  PointCloudXYZI::Ptr cur_pcl_un_;
+  PointCloudLivox::Ptr cur_pcl_un_;
 
   double dt_l_c_;
 
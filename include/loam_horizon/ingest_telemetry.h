@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+/// Counters of what livox_repub receives, written by the callbacks and read
+/// and reset once a second by the telemetry thread. Every update is a relaxed
+/// atomic add or max, no lock is taken and nothing is allocated. Per packet
+/// the callback pays these uncontended atomics and three clock reads: the
+/// ROS time for the stamp age and the steady clock around the callback.
+
+/// Raises a to v if v is larger
+inline void AtomicMax(std::atomic<uint64_t> &a, uint64_t v) {
+  uint64_t cur = a.load(std::memory_order_relaxed);
+  while (v > cur &&
+         !a.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {
+  }
+}
+
+/// Lowers a to v if v is smaller
+inline void AtomicMin(std::atomic<uint64_t> &a, uint64_t v) {
+  uint64_t cur = a.load(std::memory_order_relaxed);
+  while (v < cur &&
+         !a.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {
+  }
+}
+
+inline void AtomicAdd(std::atomic<uint64_t> &a, uint64_t v) {
+  a.fetch_add(v, std::memory_order_relaxed);
+}
+
+/// Reads a and sets it back to v
+inline uint64_t AtomicTake(std::atomic<uint64_t> &a, uint64_t v = 0) {
+  return a.exchange(v, std::memory_order_relaxed);
+}
+
+/// Per input lidar
+struct LidarCounters {
+  /// Bucket k counts the timebase gaps between packets of [2^k, 2^(k+1))
+  /// us, bucket 0 also the shorter ones and the last one the longer ones
+  static constexpr int kGapBuckets = 20;
+  /// Longer gaps count as this long, 10 s. Its square is 1e14, so the sum
+  /// of the squares holds 180000 gaps of it, far more packets than a lidar
+  /// sends between two reports.
+  static constexpr uint64_t kGapCapUs = 10000000;
+
+  std::atomic<uint64_t> packets{0}, points{0};
+  std::atomic<uint64_t> gap_histogram[kGapBuckets] = {};
+  /// Sums of the gaps (us) and their squares, for their mean and jitter
+  std::atomic<uint64_t> gap_sum_us{0}, gap_sq_sum_us{0}, gap_max_us{0};
+  /// Packets whose timebase is not after the one before
+  std::atomic<uint64_t> time_backs{0};
+  /// ROS time at the callback minus the packet stamp, 0 if not later
+  std::atomic<uint64_t> stamp_age_max_us{0};
+
+  /// Timebase of the packet before, callback thread only
+  uint64_t last_timebase = 0;
+
+  /// Counts a packet of point_num points
+  void Packet(uint64_t timebase, uint32_t point_num) {
+    AtomicAdd(packets, 1);
+    AtomicAdd(points, point_num);
+    if (last_timebase != 0) {
+      if (timebase <= last_timebase) {
+        AtomicAdd(time_backs, 1);
+      } else {
+        uint64_t gap_us = (timebase - last_timebase) / 1000;
+        gap_us = gap_us < kGapCapUs ? gap_us : kGapCapUs;
+        int bucket = 0;
+        while (bucket + 1 < kGapBuckets && gap_us >> (bucket + 1)) bucket++;
+        AtomicAdd(gap_histogram[bucket], 1);
+        AtomicAdd(gap_sum_us, gap_us);
+        AtomicAdd(gap_sq_sum_us, gap_us * gap_us);
+        AtomicMax(gap_max_us, gap_us);
+      }
+    }
+    last_timebase = timebase;
+  }
+};
+
+/// Of livox_repub as a whole
+struct IngestCounters {
+  /// Callback time, from the packet in to its frames out
+  std::atomic<uint64_t> callbacks{0}, callback_sum_us{0}, callback_max_us{0};
+  std::atomic<uint64_t> frames{0}, frame_points_sum{0}, frame_points_max{0};
+  std::atomic<uint64_t> frame_points_min{
+      std::numeric_limits<uint64_t>::max()};
+  /// Packets held back, waiting for their windows to complete
+  std::atomic<uint64_t> queue_depth_max{0};
+
+  void Frame(uint64_t num_points) {
+    AtomicAdd(frames, 1);
+    AtomicAdd(frame_points_sum, num_points);
+    AtomicMax(frame_points_max, num_points);
+    AtomicMin(frame_points_min, num_points);
+  }
+
+  void Callback(uint64_t us, uint64_t queue_depth) {
+    AtomicAdd(callbacks, 1);
+    AtomicAdd(callback_sum_us, us);
+    AtomicMax(callback_max_us, us);
+    AtomicMax(queue_depth_max, queue_depth);
+  }
+};
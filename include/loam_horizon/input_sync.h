@@ -0,0 +1,42 @@
+#pragma once
+
+#include <ros/ros.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+/// Hands the messages of a node from its callbacks to its processing loop.
+/// The callbacks Push() into the buffers under the lock and wake the loop,
+/// the loop sleeps in Wait() until its take function finds a complete,
+/// synchronized set of inputs in the buffers and moves it out, under the
+/// same lock. A frame is processed as soon as its last message is in, with
+/// no polling period in between.
+class InputSync {
+ public:
+  /// Runs push() under the lock, then wakes the loop
+  template <typename F>
+  void Push(F push) {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      push();
+    }
+    cv_.notify_one();
+  }
+
+  /// Blocks until take() returns true, take() is tried under the lock at
+  /// every push. False once ROS shuts down.
+  template <typename F>
+  bool Wait(F take) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (ros::ok()) {
+      if (take()) return true;
+      /// A push wakes it at once, the timeout only notices a shutdown
+      cv_.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    return false;
+  }
+
+ private:
+  std::mutex mtx_;
+  std::condition_variable cv_;
+};
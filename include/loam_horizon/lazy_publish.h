@@ -0,0 +1,31 @@
+#pragma once
+
+#include <ros/ros.h>
+#include <atomic>
+#include <cstdint>
+
+/// Bytes of messages this node built for topics nobody subscribed to
+inline std::atomic<uint64_t> &UnconsumedBytes() {
+  static std::atomic<uint64_t> bytes{0};
+  return bytes;
+}
+
+/// Whether a product of pub is worth computing at all
+inline bool HasSubscribers(const ros::Publisher &pub) {
+  return pub.getNumSubscribers() > 0;
+}
+
+/// Publishes msg, and counts it as wasted when nobody listens
+template <typename M>
+void PublishTracked(const ros::Publisher &pub, const M &msg) {
+  if (!HasSubscribers(pub)) {
+    UnconsumedBytes() += ros::serialization::serializationLength(msg);
+  }
+  pub.publish(msg);
+}
+
+/// Logs the counter, at most every 10 s
+inline void LogUnconsumedBytes() {
+  ROS_INFO_THROTTLE(10, "built but unconsumed: %.3f MB",
+                    UnconsumedBytes().load() / 1e6);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/register_point_struct.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
+#include <cstddef>
+#include <cstdint>
+
+/// Point of a Livox frame as livox_repub publishes it and imu_process
+/// undistorts it, 20 bytes. The time and the line have fields of their own,
+/// instead of being packed into one float intensity.
+struct LivoxPoint {
+  float x, y, z;
+  /// Seconds since the frame stamp
+  float t_offset;
+  /// Line, after the lines of the lidars merged before this one
+  uint8_t line;
+  uint8_t reflectivity;
+};
+static_assert(sizeof(LivoxPoint) == 20, "LivoxPoint is 20 bytes on the wire");
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(
+    LivoxPoint,
+    (float, x, x)(float, y, y)(float, z, z)(float, t_offset, t_offset)(
+        uint8_t, line, line)(uint8_t, reflectivity, reflectivity))
+
+typedef pcl::PointCloud<LivoxPoint> PointCloudLivox;
+
+/// Gives msg the fields of LivoxPoint, laid out as the struct is, so the
+/// points can be written straight into msg->data
+inline void SetLivoxFields(sensor_msgs::PointCloud2 *msg) {
+  sensor_msgs::PointCloud2Modifier modifier(*msg);
+  modifier.setPointCloud2Fields(
+      6, "x", 1, sensor_msgs::PointField::FLOAT32, "y", 1,
+      sensor_msgs::PointField::FLOAT32, "z", 1,
+      sensor_msgs::PointField::FLOAT32, "t_offset", 1,
+      sensor_msgs::PointField::FLOAT32, "line", 1,
+      sensor_msgs::PointField::UINT8, "reflectivity", 1,
+      sensor_msgs::PointField::UINT8);
+  /// The modifier packs the fields, the struct pads to 4 bytes
+  msg->point_step = sizeof(LivoxPoint);
+  msg->row_step = msg->width * msg->point_step;
+}
+
+/// Whether the points of msg are LivoxPoints as they are in memory
+inline bool HasLivoxLayout(const sensor_msgs::PointCloud2 &msg) {
+  if (msg.point_step != sizeof(LivoxPoint) || msg.is_bigendian ||
+      msg.data.size() < (size_t)msg.width * msg.height * msg.point_step) {
+    return false;
+  }
+  struct Field {
+    const char *name;
+    uint32_t offset;
+    uint8_t datatype;
+  };
+  static const Field kFields[] = {
+      {"x", offsetof(LivoxPoint, x), sensor_msgs::PointField::FLOAT32},
+      {"y", offsetof(LivoxPoint, y), sensor_msgs::PointField::FLOAT32},
+      {"z", offsetof(LivoxPoint, z), sensor_msgs::PointField::FLOAT32},
+      {"t_offset", offsetof(LivoxPoint, t_offset),
+       sensor_msgs::PointField::FLOAT32},
+      {"line", offsetof(LivoxPoint, line), sensor_msgs::PointField::UINT8},
+      {"reflectivity", offsetof(LivoxPoint, reflectivity),
+       sensor_msgs::PointField::UINT8}};
+  for (const Field &want : kFields) {
+    bool found = false;
+    for (const auto &field : msg.fields) {
+      if (field.name != want.name) continue;
+      found = field.offset == want.offset && field.datatype == want.datatype;
+      break;
+    }
+    if (!found) return false;
+  }
+  return true;
+}
+
+/// The points of msg read in place, nullptr if msg is not a LivoxPoint
+/// cloud. The message buffer of a vector is aligned for any scalar.
+inline const LivoxPoint *LivoxPoints(const sensor_msgs::PointCloud2 &msg) {
+  if (!HasLivoxLayout(msg)) return nullptr;
+  return reinterpret_cast<const LivoxPoint *>(msg.data.data());
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+/// Point-rate budget, off at 0 points/s. Over the budget every line is thinned
+/// to the same fraction of its points, evenly: a line keeps its time order
+/// and an even spacing, only sparser. Each point is kept or dropped once, as
+/// its packet comes in, so frames overlapping in time share the same points.
+/// The fraction is picked from the smoothed rate of the points offered
+/// before, counting the points the ingest filter kept.
+struct PointRateBudget {
+  /// Lines of all the lidars, the line field of a LivoxPoint is a byte
+  static constexpr int kMaxLines = 256;
+
+  double points_per_second = 0;
+  /// Points offered per second, smoothed; 0 before two frames
+  double offered_rate = 0;
+  /// Fraction of the points kept, 1 under the budget
+  float ratio = 1;
+  /// Per line, the share of a point owed to it; a point is kept at 1
+  float credit[kMaxLines] = {};
+
+  /// Points offered and kept since the frame before
+  uint32_t offered = 0, kept = 0;
+  /// Stamp of the frame before, the rate is measured between stamps
+  uint64_t last_stamp = 0;
+
+  /// Whether a point of line, in [0, kMaxLines), is kept, called once per
+  /// point coming in
+  bool Keep(int line) {
+    offered++;
+    float& c = credit[line];
+    c += ratio;
+    if (c < 1) return false;
+    c -= 1;
+    kept++;
+    return true;
+  }
+
+  /// Measures the rate at the frame stamped stamp_ns and picks the ratio of
+  /// the points after it. The points offered since the frame before came in
+  /// over the time between their stamps, a stride of overlapping frames, so
+  /// each point counts once however many frames it falls in.
+  void Update(uint64_t stamp_ns) {
+    const uint64_t period = stamp_ns - last_stamp;
+    /// A gap or a jump back of the stamps says nothing of the rate
+    if (last_stamp != 0 && stamp_ns > last_stamp && period < 1000000000) {
+      const double rate = offered / (period * 1e-9);
+      offered_rate =
+          offered_rate > 0 ? 0.8 * offered_rate + 0.2 * rate : rate;
+      ratio = std::min(1.0, points_per_second / offered_rate);
+    }
+    last_stamp = stamp_ns;
+    offered = kept = 0;
+  }
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// A fixed set of worker threads for fork-join loops. The threads are
+/// started once and sleep between jobs, so a per-frame ParallelFor costs a
+/// wake-up instead of a thread creation.
+class ThreadPool {
+ public:
+  /// num_threads counts the calling thread, 1 runs everything inline
+  explicit ThreadPool(int num_threads) {
+    for (int i = 1; i < num_threads; i++) {
+      workers_.emplace_back([this] { WorkerLoop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      stop_ = true;
+    }
+    cv_job_.notify_all();
+    for (auto &th : workers_) th.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  int size() const { return workers_.size() + 1; }
+
+  /// Calls fn(i) for every i in [0, n) and returns when all calls are done.
+  /// Indices are handed out dynamically, fn must not depend on the order.
+  void ParallelFor(int n, const std::function<void(int)> &fn) {
+    if (workers_.empty() || n <= 1) {
+      for (int i = 0; i < n; i++) fn(i);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      job_ = &fn;
+      job_size_ = n;
+      next_ = 0;
+      busy_ = workers_.size();
+      generation_++;
+    }
+    cv_job_.notify_all();
+    RunJob(fn, n);
+
+    std::unique_lock<std::mutex> lock(mtx_);
+    cv_done_.wait(lock, [this] { return busy_ == 0; });
+    job_ = nullptr;
+  }
+
+ private:
+  void RunJob(const std::function<void(int)> &fn, int n) {
+    for (int i = next_++; i < n; i = next_++) fn(i);
+  }
+
+  void WorkerLoop() {
+    uint64_t seen = 0;
+    while (true) {
+      const std::function<void(int)> *job;
+      int n;
+      {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_job_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) return;
+        seen = generation_;
+        job = job_;
+        n = job_size_;
+      }
+      RunJob(*job, n);
+      {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (--busy_ == 0) cv_done_.notify_one();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex mtx_;
+  std::condition_variable cv_job_;
+  std::condition_variable cv_done_;
+
+  const std::function<void(int)> *job_ = nullptr;
+  int job_size_ = 0;
+  std::atomic<int> next_{0};
+  uint64_t generation_ = 0;
+  int busy_ = 0;
+  bool stop_ = false;
+};
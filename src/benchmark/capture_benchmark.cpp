@@ -0,0 +1,98 @@
+// Runs scanRegistration's ingest and feature extraction over a capture at
+// full CPU speed, reading the point columns in place, for repeatable
+// timings on recorded data.
+//   rosrun loam_horizon capture_benchmark <capture> [frame_ms] [threads]
+//       [minimum_range]
+// Frames are cut at packet boundaries every frame_ms (100) of timebase, the
+// lines of lidar k come after the 6 lines of each lidar before it. A frame
+// is built as the LivoxPoints livox_repub publishes, then goes through the
+// ScanIngest of scanRegistration with minimum_range (0.3, as in the launch
+// files) and the FeatureExtractor. livox_repub's ingest filter and point
+// budget are not applied, as at their launch defaults, and the ROS
+// transport between the nodes is not counted: the real time factor is the
+// one of these stages, not of the whole pipeline.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "capture/livox_capture.h"
+#include "capture_frames.h"
+#include "feature_extractor/feature_extractor.h"
+#include "feature_extractor/scan_ingest.h"
+#include "loam_horizon/common.h"
+#include "loam_horizon/livox_point.h"
+#include "loam_horizon/tic_toc.h"
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "usage: %s <capture> [frame_ms] [threads] [minimum_range]\n",
+            argv[0]);
+    return 1;
+  }
+  const uint64_t frame_ns =
+      (argc > 2 ? std::atoi(argv[2]) : 100) * 1000000ull;
+  FeatureExtractorConfig config;
+  config.num_threads = argc > 3 ? std::atoi(argv[3]) : 1;
+  const float minimum_range = argc > 4 ? std::atof(argv[4]) : 0.3;
+
+  TicToc t_open;
+  CaptureReader reader;
+  if (!reader.Open(argv[1])) {
+    fprintf(stderr, "%s\n", reader.error().c_str());
+    return 1;
+  }
+  const double ms_open = t_open.toc();
+
+  /// Frames as packet lists, and the lines they need
+  std::vector<std::vector<size_t>> frames;
+  size_t num_points;
+  const int num_lidars = SplitFrames(reader, frame_ns, &frames, &num_points);
+  const int num_lines = num_lidars * kLinesPerLidar;
+
+  FeatureExtractor extractor(config);
+  ScanIngest scan_ingest;
+  std::vector<LivoxPoint> frame_points;
+  PointCloudXYZI cloud;
+  std::vector<int> line_size;
+  FeatureSet features;
+  double ms_frame = 0, ms_ingest = 0, ms_extract = 0, ms_max = 0;
+  size_t num_features = 0;
+  for (const auto &frame : frames) {
+    TicToc t_frame;
+    BuildFrame(reader, frame, &frame_points);
+    const double build = t_frame.toc();
+    TicToc t_ingest;
+    scan_ingest.Ingest(frame_points.data(), frame_points.size(), num_lines,
+                       minimum_range, &cloud, &line_size, nullptr);
+    const double ingest = t_ingest.toc();
+    TicToc t_extract;
+    extractor.Extract(cloud.points.data(), line_size, &features);
+    const double extract = t_extract.toc();
+    ms_frame += build;
+    ms_ingest += ingest;
+    ms_extract += extract;
+    ms_max = std::max(ms_max, build + ingest + extract);
+    num_features += features.surf_less_flat.size() +
+                    features.corner_less_sharp.size();
+  }
+
+  const size_t n = std::max<size_t>(frames.size(), 1);
+  const double seconds = frames.size() * frame_ns * 1e-9;
+  printf("%s: %zu records%s, mapped in %.3f ms\n", argv[1], reader.size(),
+         reader.recovered() ? " (recovered, not closed)" : "", ms_open);
+  printf("%zu frames of %lu ms, %d lidars, %zu points, "
+         "%zu less-sharp + less-flat features\n",
+         frames.size(), (unsigned long)(frame_ns / 1000000), num_lidars,
+         num_points, num_features);
+  const double ms_total = ms_frame + ms_ingest + ms_extract;
+  printf("per frame: frame %.3f ms, ingest %.3f ms, extract %.3f ms, "
+         "max %.3f ms | %.1f Mpts/s, %.1fx real time for these stages\n",
+         ms_frame / n, ms_ingest / n, ms_extract / n, ms_max,
+         num_points / std::max(ms_total * 1e3, 1e-9),
+         seconds * 1e3 / std::max(ms_total, 1e-9));
+  return 0;
+}
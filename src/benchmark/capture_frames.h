@@ -0,0 +1,75 @@
+#ifndef LOAM_HORIZON_CAPTURE_FRAMES_H
+#define LOAM_HORIZON_CAPTURE_FRAMES_H
+
+// Frames of a capture for the benchmarks, built as livox_repub publishes
+// them.
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "capture/livox_capture.h"
+#include "loam_horizon/livox_point.h"
+
+constexpr int kLinesPerLidar = 6;
+
+/// Cuts the packets of reader into frames at packet boundaries, every
+/// frame_ns of timebase or where the time goes back. Returns the number of
+/// lidars, the lines of lidar k come after the 6 lines of each lidar before
+/// it.
+inline int SplitFrames(const CaptureReader &reader, uint64_t frame_ns,
+                       std::vector<std::vector<size_t>> *frames,
+                       size_t *num_points) {
+  frames->assign(1, std::vector<size_t>());
+  uint64_t frame_start = 0;
+  int num_lidars = 1;
+  *num_points = 0;
+  CapturePacket packet;
+  for (size_t i = 0; i < reader.size(); i++) {
+    if (!reader.Packet(i, &packet)) continue;
+    if (frames->back().empty()) frame_start = packet.timebase;
+    if (packet.timebase >= frame_start + frame_ns ||
+        packet.timebase < frame_start) {
+      frames->emplace_back();
+      frame_start = packet.timebase;
+    }
+    frames->back().push_back(i);
+    num_lidars = std::max(num_lidars, packet.lidar + 1);
+    *num_points += packet.point_num;
+  }
+  if (frames->back().empty()) frames->pop_back();
+  return num_lidars;
+}
+
+/// Writes the points of the packets of a frame into *frame as livox_repub
+/// does: line after the lines of the lidars before, time from the first
+/// packet
+inline void BuildFrame(const CaptureReader &reader,
+                       const std::vector<size_t> &packets,
+                       std::vector<LivoxPoint> *frame) {
+  CapturePacket packet;
+  size_t num_points = 0;
+  for (size_t i : packets) {
+    reader.Packet(i, &packet);
+    num_points += packet.point_num;
+  }
+  frame->resize(num_points);
+  LivoxPoint *out = frame->data();
+  uint64_t frame_start = 0;
+  for (size_t i : packets) {
+    reader.Packet(i, &packet);
+    if (frame_start == 0) frame_start = packet.timebase;
+    const double packet_time = (packet.timebase - frame_start) * 1e-9;
+    const int line_offset = packet.lidar * kLinesPerLidar;
+    for (uint32_t k = 0; k < packet.point_num; k++, out++) {
+      out->x = packet.x[k];
+      out->y = packet.y[k];
+      out->z = packet.z[k];
+      out->t_offset = packet_time + packet.offset_time[k] * 1e-9;
+      out->line = line_offset + packet.line[k];
+      out->reflectivity = packet.reflectivity[k];
+    }
+  }
+}
+
+#endif  // LOAM_HORIZON_CAPTURE_FRAMES_H
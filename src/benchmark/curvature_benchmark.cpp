@@ -0,0 +1,143 @@
+// Times the curvature kernels specialized on the window size against the
+// generic one, alone and inside the whole extraction, on Horizon-like frames.
+// Both must give bit-identical curvature, labels, neighbor flags and
+// features; the exit status is 1 if they do not.
+//   rosrun loam_horizon curvature_benchmark [repetitions]
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "feature_extractor/curvature_kernel.h"
+#include "feature_extractor/feature_extractor.h"
+#include "loam_horizon/common.h"
+#include "loam_horizon/tic_toc.h"
+
+namespace {
+
+template <typename T>
+bool SameBytes(const std::vector<T> &a, const std::vector<T> &b) {
+  return a.size() == b.size() &&
+         (a.empty() ||
+          std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+bool SameCloud(const PointCloudXYZI &a, const PointCloudXYZI &b) {
+  return a.size() == b.size() &&
+         (a.empty() || std::memcmp(a.points.data(), b.points.data(),
+                                   a.size() * sizeof(PointType)) == 0);
+}
+
+bool SameFeatures(const FeatureSet &a, const FeatureSet &b) {
+  return SameCloud(a.corner_sharp, b.corner_sharp) &&
+         SameCloud(a.corner_less_sharp, b.corner_less_sharp) &&
+         SameCloud(a.surf_flat, b.surf_flat) &&
+         SameCloud(a.surf_less_flat, b.surf_less_flat) &&
+         SameBytes(a.corner_sharp_ind, b.corner_sharp_ind) &&
+         SameBytes(a.corner_less_sharp_ind, b.corner_less_sharp_ind) &&
+         SameBytes(a.surf_flat_ind, b.surf_flat_ind) &&
+         SameBytes(a.surf_less_flat_ind, b.surf_less_flat_ind);
+}
+
+/// num_lines lines of n points each on surfaces at a range of near_range,
+/// with a share of them behind far_range
+void MakeFrame(int num_lines, int n, float near_range, float far_range,
+               float far_share, PointCloudXYZI *cloud,
+               std::vector<int> *line_size) {
+  std::mt19937 gen(num_lines * n);
+  std::uniform_real_distribution<float> u(0, 1);
+  cloud->clear();
+  line_size->assign(num_lines, n);
+  for (int l = 0; l < num_lines; l++) {
+    for (int k = 0; k < n; k++) {
+      /// Steps every 40 points, edges for the extraction to find
+      float r = u(gen) < far_share ? far_range : near_range;
+      r += (k / 40) % 2 ? 0.3f : 0;
+      r += 0.01f * u(gen);
+      const float a = 0.0008f * k - 0.4f;
+      PointType pt;
+      pt.x = r * std::cos(a);
+      pt.y = r * std::sin(a);
+      pt.z = 0.05f * l - 0.15f;
+      pt.intensity = l;
+      pt.curvature = 0;
+      pt.normal_x = pt.normal_y = pt.normal_z = 0;
+      cloud->push_back(pt);
+    }
+  }
+}
+
+/// Returns whether the generic and specialized runs agree
+bool Run(const char *name, int num_lines, int n, float far_share, int reps) {
+  PointCloudXYZI cloud;
+  std::vector<int> line_size;
+  MakeFrame(num_lines, n, 12, 40, far_share, &cloud, &line_size);
+  const int size = cloud.size();
+  std::vector<float> x(size), y(size), z(size);
+  /// Per run, [0] generic and [1] specialized
+  std::vector<float> curvature[2];
+  std::vector<int> neighbor_picked[2], label[2];
+  FeatureSet features[2];
+  for (int i = 0; i < size; i++) {
+    x[i] = cloud.points[i].x;
+    y[i] = cloud.points[i].y;
+    z[i] = cloud.points[i].z;
+  }
+
+  double ms_kernel[2], ms_extract[2];
+  for (int specialized = 0; specialized < 2; specialized++) {
+    curvature[specialized].assign(size, 0);
+    neighbor_picked[specialized].assign(size, 0);
+    label[specialized].assign(size, 0);
+    TicToc t_kernel;
+    for (int r = 0; r < reps; r++) {
+      ComputeCurvature(x.data(), y.data(), z.data(), size, true,
+                       curvature[specialized].data(),
+                       neighbor_picked[specialized].data(),
+                       label[specialized].data(), specialized);
+    }
+    ms_kernel[specialized] = t_kernel.toc() / reps;
+
+    FeatureExtractorConfig config;
+    config.specialized_kernels = specialized;
+    FeatureExtractor extractor(config);
+    extractor.Extract(cloud.points.data(), line_size, &features[specialized]);
+    TicToc t_extract;
+    for (int r = 0; r < reps; r++) {
+      extractor.Extract(cloud.points.data(), line_size,
+                        &features[specialized]);
+    }
+    ms_extract[specialized] = t_extract.toc() / reps;
+  }
+
+  printf("%-8s %2d x %5d pts far %3.0f%% | kernel generic %6.3f ms "
+         "specialized %6.3f ms x%.2f | extract %6.3f ms %6.3f ms x%.2f\n",
+         name, num_lines, n, 100 * far_share, ms_kernel[0], ms_kernel[1],
+         ms_kernel[0] / ms_kernel[1], ms_extract[0], ms_extract[1],
+         ms_extract[0] / ms_extract[1]);
+
+  const bool same = SameBytes(curvature[0], curvature[1]) &&
+                    SameBytes(neighbor_picked[0], neighbor_picked[1]) &&
+                    SameBytes(label[0], label[1]) &&
+                    SameFeatures(features[0], features[1]);
+  if (!same) printf("%-8s MISMATCH between generic and specialized\n", name);
+  return same;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const int reps = argc > 1 ? std::atoi(argv[1]) : 200;
+
+  /// A 10 Hz Horizon frame, everything near, and with far points
+  bool same = Run("near", 6, 4000, 0, reps);
+  same &= Run("mixed", 6, 4000, 0.3, reps);
+  /// Once a point is far the rest of the frame takes the small window
+  same &= Run("far", 6, 4000, 1, reps);
+  /// A 16 line spinning lidar
+  same &= Run("16 line", 16, 1800, 0.3, reps);
+  return same ? 0 : 1;
+}
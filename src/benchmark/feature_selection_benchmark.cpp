@@ -0,0 +1,282 @@
+// Times the region feature selection of FeatureExtractor, lazy heaps of the
+// sharp and flat candidates, against the insertion sort of every region it
+// replaced, kept here as the reference. Both must give the same curvature,
+// labels and neighbor flags; the exit status is 1 if they do not.
+//   rosrun loam_horizon feature_selection_benchmark [capture] [frames]
+// Without a capture, frames (200) of 6 lines x 4000 synthetic points are
+// used. A capture is cut into 100 ms frames and ingested as in
+// capture_benchmark.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "capture/livox_capture.h"
+#include "capture_frames.h"
+#include "feature_extractor/curvature_kernel.h"
+#include "feature_extractor/feature_extractor.h"
+#include "feature_extractor/scan_ingest.h"
+#include "loam_horizon/common.h"
+#include "loam_horizon/livox_point.h"
+#include "loam_horizon/tic_toc.h"
+
+namespace {
+
+/// The values of feature_extractor.cpp
+constexpr int kNumRegion = 50;
+constexpr int kNumEdgeNeighbor = 5;
+constexpr int kNumFlatNeighbor = 5;
+
+/// threshold_sharp and threshold_flat of loam_livox_horizon.launch
+constexpr float kThresholdSharp = 0.1;
+constexpr float kThresholdFlat = 0.01;
+
+/// The selection as scanRegistration did it before the heaps: every region
+/// insertion-sorted by curvature, its sorted order then walked from the
+/// largest curvature for the sharp features and from the smallest for the
+/// flat ones. Empty regions are skipped as the extractor does, the old loop
+/// read the slot before them.
+class ReferenceSelection {
+ public:
+  void Run(const PointType *points, const std::vector<int> &line_size,
+           const FeatureQuota &quota) {
+    const int size = Layout(points, line_size);
+    const int curv_size = ComputeCurvature(
+        x_.data(), y_.data(), z_.data(), size, true, curvature_.data(),
+        neighbor_picked_.data(), label_.data(), true);
+    sort_time_ = 0;
+    for (size_t i = 0; i < line_size.size(); i++) {
+      if (end_[i] - start_[i] < curv_size) continue;
+      for (int j = 0; j < kNumRegion; j++) {
+        const int sp = start_[i] + (end_[i] - start_[i]) * j / kNumRegion;
+        const int ep =
+            start_[i] + (end_[i] - start_[i]) * (j + 1) / kNumRegion - 1;
+        if (ep < sp) continue;
+        SelectRegion(sp, ep, quota);
+      }
+    }
+  }
+
+  const std::vector<float> &curvature() const { return curvature_; }
+  const std::vector<int> &label() const { return label_; }
+  const std::vector<int> &neighbor_picked() const { return neighbor_picked_; }
+  /// Time spent sorting the regions in the last frame, in ms
+  double sort_time() const { return sort_time_; }
+
+ private:
+  int Layout(const PointType *points, const std::vector<int> &line_size) {
+    start_.resize(line_size.size());
+    end_.resize(line_size.size());
+    int size = 0;
+    for (size_t i = 0; i < line_size.size(); i++) {
+      start_[i] = size + 5;
+      size += line_size[i];
+      end_[i] = size - 6;
+    }
+    x_.resize(size);
+    y_.resize(size);
+    z_.resize(size);
+    curvature_.resize(size);
+    neighbor_picked_.resize(size);
+    label_.resize(size);
+    sort_ind_.resize(size);
+    for (int i = 0; i < size; i++) {
+      x_[i] = points[i].x;
+      y_[i] = points[i].y;
+      z_[i] = points[i].z;
+      sort_ind_[i] = i;
+    }
+    return size;
+  }
+
+  void SelectRegion(int sp, int ep, const FeatureQuota &quota) {
+    const float *curv = curvature_.data();
+    int *sort_ind = sort_ind_.data();
+    int *picked = neighbor_picked_.data();
+
+    TicToc t_sort;
+    /// sort the curvatures from small to large
+    for (int k = sp + 1; k <= ep; k++) {
+      for (int l = k; l >= sp + 1; l--) {
+        if (curv[sort_ind[l]] < curv[sort_ind[l - 1]]) {
+          std::swap(sort_ind[l - 1], sort_ind[l]);
+        }
+      }
+    }
+    float sum_curv = 0;
+    const float max_curv = curv[sort_ind[ep]];
+    for (int k = ep - 1; k >= sp; k--) sum_curv += curv[sort_ind[k]];
+    if (max_curv > 3 * sum_curv) picked[sort_ind[ep]] = 1;
+    sort_time_ += t_sort.toc();
+
+    int largest_picked = 0;
+    for (int k = ep; k >= sp; k--) {
+      const int ind = sort_ind[k];
+      if (picked[ind] != 0) continue;
+      if (curv[ind] > kThresholdSharp) {
+        largest_picked++;
+        if (largest_picked <= quota.num_edge) {
+          label_[ind] = 2;
+        } else if (largest_picked <= quota.num_less_edge) {
+          label_[ind] = 1;
+        } else {
+          break;
+        }
+        picked[ind] = 1;
+        MarkNeighbors(ind, kNumEdgeNeighbor);
+      }
+    }
+
+    int smallest_picked = 0;
+    for (int k = sp; k <= ep; k++) {
+      const int ind = sort_ind[k];
+      if (picked[ind] != 0) continue;
+      if (curv[ind] < kThresholdFlat) {
+        label_[ind] = -1;
+        picked[ind] = 1;
+        smallest_picked++;
+        if (smallest_picked >= quota.num_flat) break;
+        MarkNeighbors(ind, kNumFlatNeighbor);
+      }
+    }
+  }
+
+  void MarkNeighbors(int ind, int num) {
+    for (int l = 1; l <= num; l++) {
+      if (SqDistance(ind + l, ind + l - 1) > 0.02) break;
+      neighbor_picked_[ind + l] = 1;
+    }
+    for (int l = -1; l >= -num; l--) {
+      if (SqDistance(ind + l, ind + l + 1) > 0.02) break;
+      neighbor_picked_[ind + l] = 1;
+    }
+  }
+
+  float SqDistance(int a, int b) const {
+    const float dx = x_[a] - x_[b];
+    const float dy = y_[a] - y_[b];
+    const float dz = z_[a] - z_[b];
+    return dx * dx + dy * dy + dz * dz;
+  }
+
+  std::vector<float> x_, y_, z_, curvature_;
+  std::vector<int> sort_ind_, neighbor_picked_, label_;
+  std::vector<int> start_, end_;
+  double sort_time_ = 0;
+};
+
+/// 6 lines of n points over walls at random ranges, with steps and noise
+void MakeFrame(unsigned seed, int n, PointCloudXYZI *cloud,
+               std::vector<int> *line_size) {
+  constexpr int kLines = 6;
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<float> u(0, 1);
+  cloud->clear();
+  line_size->assign(kLines, n);
+  for (int l = 0; l < kLines; l++) {
+    float range = 5 + 30 * u(gen);
+    for (int k = 0; k < n; k++) {
+      /// A new wall now and then, an edge for the extraction to find
+      if (u(gen) < 0.01f) range = 5 + 30 * u(gen);
+      const float r = range + 0.02f * u(gen);
+      const float a = 0.00035f * k - 0.7f;
+      PointType pt;
+      pt.x = r * std::cos(a);
+      pt.y = r * std::sin(a);
+      pt.z = r * (0.04f * l - 0.1f);
+      pt.intensity = l;
+      pt.curvature = 0;
+      pt.normal_x = pt.normal_y = pt.normal_z = 0;
+      cloud->push_back(pt);
+    }
+  }
+}
+
+template <typename T>
+bool SameBytes(const std::vector<T> &a, const std::vector<T> &b, size_t n) {
+  return a.size() >= n && b.size() >= n &&
+         (n == 0 || std::memcmp(a.data(), b.data(), n * sizeof(T)) == 0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const char *capture = argc > 1 ? argv[1] : nullptr;
+  const int max_frames = argc > 2 ? std::atoi(argv[2]) : 200;
+
+  CaptureReader reader;
+  std::vector<std::vector<size_t>> packets;
+  int num_lines = 6;
+  if (capture) {
+    if (!reader.Open(capture)) {
+      fprintf(stderr, "%s\n", reader.error().c_str());
+      return 1;
+    }
+    size_t num_points;
+    num_lines = SplitFrames(reader, 100000000, &packets, &num_points) *
+                kLinesPerLidar;
+  }
+  const int num_frames =
+      capture ? std::min<int>(packets.size(), max_frames) : max_frames;
+
+  FeatureExtractorConfig config;
+  config.threshold_sharp = kThresholdSharp;
+  config.threshold_flat = kThresholdFlat;
+  FeatureExtractor extractor(config);
+  ReferenceSelection reference;
+  ScanIngest scan_ingest;
+  std::vector<LivoxPoint> frame_points;
+  PointCloudXYZI cloud;
+  std::vector<int> line_size;
+  FeatureSet features;
+
+  double ms_sort[2] = {}, ms_total[2] = {};
+  size_t num_points = 0;
+  int mismatches = 0;
+  for (int f = 0; f < num_frames; f++) {
+    if (capture) {
+      BuildFrame(reader, packets[f], &frame_points);
+      scan_ingest.Ingest(frame_points.data(), frame_points.size(), num_lines,
+                         0.3, &cloud, &line_size, nullptr);
+    } else {
+      MakeFrame(f, 4000, &cloud, &line_size);
+    }
+    const size_t size = cloud.size();
+    num_points += size;
+
+    TicToc t_reference;
+    reference.Run(cloud.points.data(), line_size, config.quota);
+    ms_total[0] += t_reference.toc();
+    ms_sort[0] += reference.sort_time();
+
+    TicToc t_extract;
+    extractor.Extract(cloud.points.data(), line_size, &features);
+    ms_total[1] += t_extract.toc();
+    ms_sort[1] += extractor.sort_time();
+
+    if (!SameBytes(reference.curvature(), extractor.curvature(), size) ||
+        !SameBytes(reference.label(), extractor.label(), size) ||
+        !SameBytes(reference.neighbor_picked(), extractor.neighbor_picked(),
+                   size)) {
+      if (mismatches++ < 10) printf("frame %d: MISMATCH\n", f);
+    }
+  }
+
+  const int n = std::max(num_frames, 1);
+  printf("%s: %d frames, %.0f points each, %d lines\n",
+         capture ? capture : "synthetic", num_frames,
+         (double)num_points / n, num_lines);
+  printf("ordering per frame: insertion sort %.3f ms, heaps %.3f ms x%.1f\n",
+         ms_sort[0] / n, ms_sort[1] / n,
+         ms_sort[0] / std::max(ms_sort[1], 1e-9));
+  printf("per frame: reference curvature + selection %.3f ms, "
+         "extractor %.3f ms (also builds the feature clouds)\n",
+         ms_total[0] / n, ms_total[1] / n);
+  printf("%d frames with different curvature, labels or neighbor flags\n",
+         mismatches);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,127 @@
+// Times VoxelFilter against pcl::VoxelGrid on clouds shaped like the ones
+// laserMapping and scanRegistration downsample. The outputs hold the same
+// voxels in another order: VoxelFilter in insertion order, pcl::VoxelGrid
+// sorted by voxel index. Each case checks that the centroids are those of
+// pcl::VoxelGrid once both are put in voxel order.
+//   rosrun loam_horizon voxel_filter_benchmark [repetitions]
+
+#include <pcl/filters/voxel_grid.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "feature_extractor/voxel_filter.h"
+#include "loam_horizon/common.h"
+#include "loam_horizon/tic_toc.h"
+
+namespace {
+
+/// n points on a few planes of a box of the given extent, with noise
+PointCloudXYZI::Ptr MakeCloud(int n, float extent, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<float> u(-extent / 2, extent / 2);
+  std::normal_distribution<float> noise(0, 0.02);
+  PointCloudXYZI::Ptr cloud(new PointCloudXYZI());
+  cloud->points.resize(n);
+  for (int i = 0; i < n; i++) {
+    PointType &pt = cloud->points[i];
+    pt.x = u(gen);
+    pt.y = u(gen);
+    pt.z = u(gen);
+    switch (i % 3) {
+      case 0: pt.z = -2 + noise(gen); break;          // ground
+      case 1: pt.x = extent / 4 + noise(gen); break;  // wall
+      default: break;                                 // clutter
+    }
+    pt.intensity = i % 6 + 0.05;
+    pt.curvature = 1;
+    pt.normal_x = pt.normal_y = pt.normal_z = 0;
+  }
+  cloud->width = n;
+  cloud->height = 1;
+  return cloud;
+}
+
+/// Whether a and b hold the same centroids up to tol, in any order. A
+/// centroid lies in its voxel, so both are sorted by the voxel they fall in.
+bool SameVoxels(const PointCloudXYZI &a, const PointCloudXYZI &b, float leaf,
+                float tol) {
+  if (a.size() != b.size()) return false;
+  auto sorted = [leaf](const PointCloudXYZI &cloud) {
+    std::vector<std::tuple<int, int, int, int>> keys(cloud.size());
+    for (size_t i = 0; i < cloud.size(); i++) {
+      const PointType &pt = cloud.points[i];
+      keys[i] = std::make_tuple(static_cast<int>(std::floor(pt.x / leaf)),
+                                static_cast<int>(std::floor(pt.y / leaf)),
+                                static_cast<int>(std::floor(pt.z / leaf)),
+                                static_cast<int>(i));
+    }
+    std::sort(keys.begin(), keys.end());
+    return keys;
+  };
+  const auto ka = sorted(a), kb = sorted(b);
+  for (size_t i = 0; i < ka.size(); i++) {
+    const PointType &pa = a.points[std::get<3>(ka[i])];
+    const PointType &pb = b.points[std::get<3>(kb[i])];
+    if (std::fabs(pa.x - pb.x) > tol || std::fabs(pa.y - pb.y) > tol ||
+        std::fabs(pa.z - pb.z) > tol) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Run(const char *name, int n, float extent, float leaf, int reps) {
+  PointCloudXYZI::Ptr cloud = MakeCloud(n, extent, n);
+  PointCloudXYZI out_pcl, out_centroid, out_first;
+
+  pcl::VoxelGrid<PointType> voxel_grid;
+  voxel_grid.setLeafSize(leaf, leaf, leaf);
+  voxel_grid.setInputCloud(cloud);
+  TicToc t_pcl;
+  for (int r = 0; r < reps; r++) voxel_grid.filter(out_pcl);
+  const double ms_pcl = t_pcl.toc() / reps;
+
+  VoxelFilter centroid(VoxelFilter::kCentroid);
+  centroid.setLeafSize(leaf, leaf, leaf);
+  centroid.setInputCloud(cloud);
+  TicToc t_centroid;
+  for (int r = 0; r < reps; r++) centroid.filter(out_centroid);
+  const double ms_centroid = t_centroid.toc() / reps;
+
+  VoxelFilter first(VoxelFilter::kFirstPoint);
+  first.setLeafSize(leaf, leaf, leaf);
+  first.setInputCloud(cloud);
+  TicToc t_first;
+  for (int r = 0; r < reps; r++) first.filter(out_first);
+  const double ms_first = t_first.toc() / reps;
+
+  printf("%-10s %8d pts %7.1f m leaf %.2f | pcl %8.3f ms (%7lu) | "
+         "centroid %8.3f ms (%7lu) x%.1f | first %8.3f ms (%7lu) x%.1f\n",
+         name, n, extent, leaf, ms_pcl, out_pcl.size(), ms_centroid,
+         out_centroid.size(), ms_pcl / ms_centroid, ms_first,
+         out_first.size(), ms_pcl / ms_first);
+  if (!SameVoxels(out_pcl, out_centroid, leaf, 1e-3f * leaf)) {
+    printf("%-10s centroids differ from pcl::VoxelGrid\n", name);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const int reps = argc > 1 ? std::atoi(argv[1]) : 20;
+
+  /// Less-flat points of one line, and the feature clouds of a frame
+  Run("line", 2000, 40, 0.2, reps);
+  Run("frame", 20000, 80, 0.4, reps);
+  /// A map cube, and the map around the vehicle
+  Run("cube", 50000, 50, 0.8, reps);
+  Run("map", 500000, 250, 0.4, reps);
+  /// Extent and leaf whose grid has more than 2^31 cells
+  Run("large", 1000000, 5000, 0.05, std::max(1, reps / 10));
+  return 0;
+}
@@ -0,0 +1,223 @@
+#include "capture/livox_capture.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+
+namespace {
+
+constexpr char kFileMagic[8] = {'L', 'V', 'X', 'C', 'A', 'P', '0', '1'};
+constexpr char kIndexMagic[8] = {'L', 'V', 'X', 'I', 'D', 'X', '0', '1'};
+constexpr uint32_t kVersion = 1;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct Footer {
+  uint64_t index_offset;
+  uint64_t num_records;
+  char magic[8];
+};
+
+/// Bytes buffered by the writer, a few packets
+constexpr size_t kWriteBuffer = 1 << 20;
+
+}  // namespace
+
+bool CaptureWriter::Open(const std::string &path) {
+  Close();
+  error_.clear();
+  index_.clear();
+  file_ = std::fopen(path.c_str(), "wb");
+  if (!file_) {
+    error_ = path + ": " + std::strerror(errno);
+    return false;
+  }
+  std::setvbuf(file_, nullptr, _IOFBF, kWriteBuffer);
+  FileHeader header;
+  std::memcpy(header.magic, kFileMagic, 8);
+  header.version = kVersion;
+  header.reserved = 0;
+  if (std::fwrite(&header, sizeof(header), 1, file_) != 1) {
+    error_ = path + ": write failed";
+  }
+  offset_ = sizeof(header);
+  return error_.empty();
+}
+
+void CaptureWriter::WriteRecord(uint32_t type, uint64_t stamp_ns,
+                                uint32_t count,
+                                const std::vector<uint8_t> &payload) {
+  if (!file_) return;
+  CaptureRecordHeader header{type, (uint32_t)payload.size(), stamp_ns};
+  if (std::fwrite(&header, sizeof(header), 1, file_) != 1 ||
+      std::fwrite(payload.data(), 1, payload.size(), file_) !=
+          payload.size()) {
+    error_ = "write failed";
+    return;
+  }
+  index_.push_back(CaptureIndexEntry{offset_, stamp_ns, type, count});
+  offset_ += sizeof(header) + payload.size();
+}
+
+void CaptureWriter::AddImu(uint64_t stamp_ns, const CaptureImuSample &sample) {
+  payload_.resize(sizeof(sample));
+  std::memcpy(payload_.data(), &sample, sizeof(sample));
+  WriteRecord(kCaptureImu, stamp_ns, 1, payload_);
+}
+
+void CaptureWriter::AddImageStamp(uint64_t stamp_ns, uint32_t camera) {
+  payload_.assign(8, 0);
+  std::memcpy(payload_.data(), &camera, 4);
+  WriteRecord(kCaptureImageStamp, stamp_ns, camera, payload_);
+}
+
+bool CaptureWriter::Close() {
+  if (!file_) return error_.empty();
+  Footer footer;
+  footer.index_offset = offset_;
+  footer.num_records = index_.size();
+  std::memcpy(footer.magic, kIndexMagic, 8);
+  if (std::fwrite(index_.data(), sizeof(CaptureIndexEntry), index_.size(),
+                  file_) != index_.size() ||
+      std::fwrite(&footer, sizeof(footer), 1, file_) != 1) {
+    error_ = "write failed";
+  }
+  if (std::fclose(file_) != 0) error_ = "close failed";
+  file_ = nullptr;
+  return error_.empty();
+}
+
+bool CaptureReader::Open(const std::string &path) {
+  Close();
+  error_.clear();
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    error_ = path + ": " + std::strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FileHeader)) {
+    ::close(fd);
+    error_ = path + ": not a capture";
+    return false;
+  }
+  void *data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    error_ = path + ": " + std::strerror(errno);
+    return false;
+  }
+  data_ = static_cast<const uint8_t *>(data);
+  length_ = st.st_size;
+  /// Replays read front to back, let the kernel read ahead
+  ::madvise(data, length_, MADV_SEQUENTIAL);
+
+  FileHeader header;
+  std::memcpy(&header, data_, sizeof(header));
+  if (std::memcmp(header.magic, kFileMagic, 8) != 0 ||
+      header.version != kVersion) {
+    Close();
+    error_ = path + ": not a capture, or an other version";
+    return false;
+  }
+  if (!ReadIndex()) ScanRecords();
+  return true;
+}
+
+void CaptureReader::Close() {
+  if (data_) ::munmap(const_cast<uint8_t *>(data_), length_);
+  data_ = nullptr;
+  length_ = 0;
+  index_.clear();
+  recovered_ = false;
+}
+
+bool CaptureReader::ReadIndex() {
+  if (length_ < sizeof(FileHeader) + sizeof(Footer)) return false;
+  Footer footer;
+  std::memcpy(&footer, data_ + length_ - sizeof(footer), sizeof(footer));
+  if (std::memcmp(footer.magic, kIndexMagic, 8) != 0) return false;
+  const uint64_t index_bytes = footer.num_records * sizeof(CaptureIndexEntry);
+  if (footer.index_offset < sizeof(FileHeader) ||
+      footer.index_offset + index_bytes + sizeof(footer) != length_) {
+    return false;
+  }
+  index_.resize(footer.num_records);
+  std::memcpy(index_.data(), data_ + footer.index_offset, index_bytes);
+  /// Every record must lie before the index
+  for (const auto &entry : index_) {
+    CaptureRecordHeader header;
+    if (entry.offset + sizeof(header) > footer.index_offset) return false;
+    std::memcpy(&header, data_ + entry.offset, sizeof(header));
+    if (entry.offset + sizeof(header) + header.size > footer.index_offset) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void CaptureReader::ScanRecords() {
+  recovered_ = true;
+  index_.clear();
+  uint64_t offset = sizeof(FileHeader);
+  while (offset + sizeof(CaptureRecordHeader) <= length_) {
+    CaptureRecordHeader header;
+    std::memcpy(&header, data_ + offset, sizeof(header));
+    const uint64_t end = offset + sizeof(header) + header.size;
+    if (end > length_ || header.type < kCaptureLidarPacket ||
+        header.type > kCaptureImageStamp) {
+      break;
+    }
+    uint32_t count = 1;
+    if (header.type != kCaptureImu && header.size >= 16) {
+      std::memcpy(&count, data_ + offset + sizeof(header) +
+                              (header.type == kCaptureLidarPacket ? 8 : 0),
+                  4);
+    }
+    index_.push_back(
+        CaptureIndexEntry{offset, header.stamp_ns, header.type, count});
+    offset = end;
+  }
+}
+
+bool CaptureReader::Packet(size_t i, CapturePacket *packet) const {
+  if (index_[i].type != kCaptureLidarPacket) return false;
+  CaptureRecordHeader header;
+  std::memcpy(&header, data_ + index_[i].offset, sizeof(header));
+  const uint8_t *p = Payload(i);
+  if (header.size < 16) return false;
+  std::memcpy(&packet->timebase, p, 8);
+  std::memcpy(&packet->point_num, p + 8, 4);
+  packet->lidar = p[12];
+  if (header.size < CapturePacketBytes(packet->point_num)) return false;
+  p += 16;
+
+  const uint32_t n = packet->point_num;
+  packet->offset_time = reinterpret_cast<const uint32_t *>(p);
+  p += CaptureColumnBytes<uint32_t>(n);
+  packet->x = reinterpret_cast<const float *>(p);
+  p += CaptureColumnBytes<float>(n);
+  packet->y = reinterpret_cast<const float *>(p);
+  p += CaptureColumnBytes<float>(n);
+  packet->z = reinterpret_cast<const float *>(p);
+  p += CaptureColumnBytes<float>(n);
+  packet->reflectivity = p;
+  packet->tag = p + CaptureColumnBytes<uint8_t>(n);
+  packet->line = packet->tag + CaptureColumnBytes<uint8_t>(n);
+  return true;
+}
+
+bool CaptureReader::Imu(size_t i, CaptureImuSample *sample) const {
+  if (index_[i].type != kCaptureImu) return false;
+  CaptureRecordHeader header;
+  std::memcpy(&header, data_ + index_[i].offset, sizeof(header));
+  if (header.size < sizeof(*sample)) return false;
+  std::memcpy(sample, Payload(i), sizeof(*sample));
+  return true;
+}
@@ -0,0 +1,127 @@
+// Converts the Livox packets, IMU samples and camera stamps of a rosbag into
+// a capture, which livox_repub (capture_file) and capture_benchmark replay
+// without roscore or rosbag parsing.
+//   rosrun loam_horizon livox_capture_convert <bag> <capture> [lidar topics]
+// Without lidar topics every livox_ros_driver/CustomMsg topic is taken, in
+// name order. Lidar k of the capture is the k-th of them, list them in the
+// order of lidar_topics.
+
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/CompressedImage.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/Imu.h>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "capture/livox_capture.h"
+#include "livox_ros_driver/CustomMsg.h"
+#include "loam_horizon/tic_toc.h"
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <bag> <capture> [lidar topics]\n", argv[0]);
+    return 1;
+  }
+  rosbag::Bag bag;
+  try {
+    bag.open(argv[1], rosbag::bagmode::Read);
+  } catch (const rosbag::BagException &e) {
+    fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  /// Topics by type, std::set keeps them in name order
+  std::set<std::string> livox_topics, imu_topics, image_topics;
+  rosbag::View all(bag);
+  for (const rosbag::ConnectionInfo *c : all.getConnections()) {
+    if (c->datatype == "livox_ros_driver/CustomMsg") {
+      livox_topics.insert(c->topic);
+    } else if (c->datatype == "sensor_msgs/Imu") {
+      imu_topics.insert(c->topic);
+    } else if (c->datatype == "sensor_msgs/Image" ||
+               c->datatype == "sensor_msgs/CompressedImage") {
+      image_topics.insert(c->topic);
+    }
+  }
+  std::vector<std::string> lidar_topics(argv + 3, argv + argc);
+  if (lidar_topics.empty()) {
+    lidar_topics.assign(livox_topics.begin(), livox_topics.end());
+  }
+  if (lidar_topics.empty() || lidar_topics.size() > 255) {
+    fprintf(stderr, "%s: no livox_ros_driver/CustomMsg topic to take\n",
+            argv[1]);
+    return 1;
+  }
+
+  std::map<std::string, int> lidar_of, camera_of;
+  std::vector<std::string> topics;
+  for (size_t l = 0; l < lidar_topics.size(); l++) {
+    lidar_of[lidar_topics[l]] = l;
+    topics.push_back(lidar_topics[l]);
+    printf("lidar %zu: %s\n", l, lidar_topics[l].c_str());
+  }
+  /// One IMU, mixing several would not make one stream
+  std::string imu_topic;
+  if (!imu_topics.empty()) {
+    imu_topic = *imu_topics.begin();
+    topics.push_back(imu_topic);
+    printf("imu: %s\n", imu_topic.c_str());
+  }
+  for (const auto &topic : image_topics) {
+    const int camera = camera_of.size();
+    camera_of[topic] = camera;
+    topics.push_back(topic);
+    printf("camera %d: %s (stamps only)\n", camera, topic.c_str());
+  }
+
+  CaptureWriter writer;
+  if (!writer.Open(argv[2])) {
+    fprintf(stderr, "%s\n", writer.error().c_str());
+    return 1;
+  }
+  TicToc t_convert;
+  size_t num_packets = 0, num_points = 0, num_imu = 0, num_images = 0;
+  rosbag::View view(bag, rosbag::TopicQuery(topics));
+  for (const rosbag::MessageInstance &m : view) {
+    if (auto packet = m.instantiate<livox_ros_driver::CustomMsg>()) {
+      auto it = lidar_of.find(m.getTopic());
+      if (it == lidar_of.end()) continue;
+      writer.AddPacket(it->second, packet->timebase, packet->points.data(),
+                       packet->points.size());
+      num_packets++;
+      num_points += packet->points.size();
+    } else if (auto imu = m.instantiate<sensor_msgs::Imu>()) {
+      CaptureImuSample sample;
+      sample.angular_velocity[0] = imu->angular_velocity.x;
+      sample.angular_velocity[1] = imu->angular_velocity.y;
+      sample.angular_velocity[2] = imu->angular_velocity.z;
+      sample.linear_acceleration[0] = imu->linear_acceleration.x;
+      sample.linear_acceleration[1] = imu->linear_acceleration.y;
+      sample.linear_acceleration[2] = imu->linear_acceleration.z;
+      writer.AddImu(imu->header.stamp.toNSec(), sample);
+      num_imu++;
+    } else if (auto image = m.instantiate<sensor_msgs::Image>()) {
+      writer.AddImageStamp(image->header.stamp.toNSec(),
+                           camera_of[m.getTopic()]);
+      num_images++;
+    } else if (auto image = m.instantiate<sensor_msgs::CompressedImage>()) {
+      writer.AddImageStamp(image->header.stamp.toNSec(),
+                           camera_of[m.getTopic()]);
+      num_images++;
+    }
+    if (!writer.error().empty()) break;
+  }
+  if (!writer.Close()) {
+    fprintf(stderr, "%s: %s\n", argv[2], writer.error().c_str());
+    return 1;
+  }
+  printf("%zu packets (%zu points), %zu imu, %zu image stamps in %.1f s\n",
+         num_packets, num_points, num_imu, num_images,
+         t_convert.toc() / 1000);
+  return 0;
+}
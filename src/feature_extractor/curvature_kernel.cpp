@@ -0,0 +1,403 @@
+#include "feature_extractor/curvature_kernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CURVATURE_KERNEL_SIMD
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define CURVATURE_KERNEL_SIMD
+#endif
+
+namespace {
+
+constexpr float kMaxFeatureDis = 1e4;
+constexpr double kMinFeatureDis = 1e-4;
+constexpr double kOcclusionRatio = 0.00015;
+
+/// Smallest float f with double(f) >= kMinFeatureDis, so that the float
+/// compare `dis < f` matches the double compare `dis < kMinFeatureDis`
+inline float MinFeatureDisF() {
+  float f = static_cast<float>(kMinFeatureDis);
+  if (static_cast<double>(f) < kMinFeatureDis) {
+    f = std::nextafter(f, std::numeric_limits<float>::infinity());
+  }
+  return f;
+}
+
+/// Reference per-point code, also used for tails and window switches.
+/// kWin > 0 has the window size unrolled and is only called while *win is
+/// kWin: it returns false, leaving the point alone, when the point switches
+/// the window. kWin = 0 is the generic version that reads the window size
+/// from *win and switches it itself.
+template <int kWin>
+bool ComputeCurvatureAt(const float *x, const float *y, const float *z,
+                        int occlusion_end, int i, bool normalize, int *win,
+                        float *curvature, int *neighbor_picked, int *label) {
+  float dis = std::sqrt(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+  if (dis > kDistanceFaraway) {
+    if (kWin != 0 && kWin != kNumCurvSizeFar) return false;
+    *win = kNumCurvSizeFar;
+  }
+  const int w = kWin > 0 ? kWin : *win;
+  float diffX = 0, diffY = 0, diffZ = 0;
+  for (int j = 1; j <= w; ++j) {
+    diffX += x[i - j] + x[i + j];
+    diffY += y[i - j] + y[i + j];
+    diffZ += z[i - j] + z[i + j];
+  }
+  diffX -= 2 * w * x[i];
+  diffY -= 2 * w * y[i];
+  diffZ -= 2 * w * z[i];
+
+  float tmp2 = diffX * diffX + diffY * diffY + diffZ * diffZ;
+  float tmp = std::sqrt(tmp2);
+
+  curvature[i] = tmp2;
+  if (normalize) {
+    /// use normalized curvature
+    curvature[i] = tmp / (2 * w * dis + 1e-3);
+  }
+  neighbor_picked[i] = 0;
+  label[i] = 0;
+
+  /// Mark un-reliable points
+  if (std::fabs(dis) > kMaxFeatureDis || std::fabs(dis) < kMinFeatureDis ||
+      !std::isfinite(dis)) {
+    label[i] = kLabelUnreliable;
+    neighbor_picked[i] = 1;
+  }
+
+  /// Mark occluded points and points on surfaces parallel to the beam
+  if (i < occlusion_end) {
+    float diffX1 = x[i + 1] - x[i];
+    float diffY1 = y[i + 1] - y[i];
+    float diffZ1 = z[i + 1] - z[i];
+    float diff = diffX1 * diffX1 + diffY1 * diffY1 + diffZ1 * diffZ1;
+
+    float diffX2 = x[i] - x[i - 1];
+    float diffY2 = y[i] - y[i - 1];
+    float diffZ2 = z[i] - z[i - 1];
+    float diff2 = diffX2 * diffX2 + diffY2 * diffY2 + diffZ2 * diffZ2;
+    float dis2 = x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+
+    if (diff > kOcclusionRatio * dis2 && diff2 > kOcclusionRatio * dis2) {
+      neighbor_picked[i] = 1;
+    }
+  }
+  return true;
+}
+
+/// Writes label / neighbor_picked of a block from per-lane bit masks
+inline void StoreFlags(int i, int lanes, int unreliable_bits, int occluded_bits,
+                       int *neighbor_picked, int *label) {
+  for (int k = 0; k < lanes; ++k) {
+    const int unreliable = (unreliable_bits >> k) & 1;
+    label[i + k] = unreliable ? kLabelUnreliable : 0;
+    neighbor_picked[i + k] = unreliable | ((occluded_bits >> k) & 1);
+  }
+}
+
+#if defined(__AVX2__)
+
+inline __m256 Norm2(__m256 x, __m256 y, __m256 z) {
+  return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)),
+                       _mm256_mul_ps(z, z));
+}
+
+/// Lanes of v as two double vectors
+inline void ToDouble(__m256 v, __m256d *lo, __m256d *hi) {
+  *lo = _mm256_cvtps_pd(_mm256_castps256_ps128(v));
+  *hi = _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+}
+
+/// Processes full blocks of 8 points from begin on, returns the first
+/// unprocessed index. The specialized versions stop at the block in which
+/// the window switches.
+template <int kWin>
+int ComputeCurvatureSimd(const float *x, const float *y, const float *z,
+                         int begin, int end, int occlusion_end, bool normalize,
+                         int *win, float *curvature, int *neighbor_picked,
+                         int *label) {
+  const __m256 v_far = _mm256_set1_ps(kDistanceFaraway);
+  const __m256 v_max_dis = _mm256_set1_ps(kMaxFeatureDis);
+  const __m256 v_min_dis = _mm256_set1_ps(MinFeatureDisF());
+  const __m256d v_eps = _mm256_set1_pd(1e-3);
+  const __m256d v_ratio = _mm256_set1_pd(kOcclusionRatio);
+
+  /// Whole blocks only, all of their points take the occlusion test
+  const int block_end = std::min(end, occlusion_end);
+  int i = begin;
+  for (; i + 8 <= block_end; i += 8) {
+    const __m256 px = _mm256_loadu_ps(x + i);
+    const __m256 py = _mm256_loadu_ps(y + i);
+    const __m256 pz = _mm256_loadu_ps(z + i);
+    const __m256 dis2 = Norm2(px, py, pz);
+    const __m256 dis = _mm256_sqrt_ps(dis2);
+
+    /// The window switches inside this block, keep the exact point order
+    if (*win != kNumCurvSizeFar &&
+        _mm256_movemask_ps(_mm256_cmp_ps(dis, v_far, _CMP_GT_OQ))) {
+      if (kWin != 0) break;
+      for (int k = 0; k < 8; ++k) {
+        ComputeCurvatureAt<0>(x, y, z, occlusion_end, i + k, normalize, win,
+                              curvature, neighbor_picked, label);
+      }
+      continue;
+    }
+
+    const int w = kWin > 0 ? kWin : *win;
+    __m256 diffX = _mm256_setzero_ps();
+    __m256 diffY = _mm256_setzero_ps();
+    __m256 diffZ = _mm256_setzero_ps();
+    for (int j = 1; j <= w; ++j) {
+      diffX = _mm256_add_ps(diffX, _mm256_add_ps(_mm256_loadu_ps(x + i - j),
+                                                 _mm256_loadu_ps(x + i + j)));
+      diffY = _mm256_add_ps(diffY, _mm256_add_ps(_mm256_loadu_ps(y + i - j),
+                                                 _mm256_loadu_ps(y + i + j)));
+      diffZ = _mm256_add_ps(diffZ, _mm256_add_ps(_mm256_loadu_ps(z + i - j),
+                                                 _mm256_loadu_ps(z + i + j)));
+    }
+    const __m256 v_2w = _mm256_set1_ps(static_cast<float>(2 * w));
+    diffX = _mm256_sub_ps(diffX, _mm256_mul_ps(v_2w, px));
+    diffY = _mm256_sub_ps(diffY, _mm256_mul_ps(v_2w, py));
+    diffZ = _mm256_sub_ps(diffZ, _mm256_mul_ps(v_2w, pz));
+    const __m256 tmp2 = Norm2(diffX, diffY, diffZ);
+
+    if (normalize) {
+      __m256d tmp_lo, tmp_hi, den_lo, den_hi;
+      ToDouble(_mm256_sqrt_ps(tmp2), &tmp_lo, &tmp_hi);
+      ToDouble(_mm256_mul_ps(v_2w, dis), &den_lo, &den_hi);
+      const __m128 curv_lo =
+          _mm256_cvtpd_ps(_mm256_div_pd(tmp_lo, _mm256_add_pd(den_lo, v_eps)));
+      const __m128 curv_hi =
+          _mm256_cvtpd_ps(_mm256_div_pd(tmp_hi, _mm256_add_pd(den_hi, v_eps)));
+      _mm256_storeu_ps(curvature + i,
+                       _mm256_insertf128_ps(_mm256_castps128_ps256(curv_lo),
+                                            curv_hi, 1));
+    } else {
+      _mm256_storeu_ps(curvature + i, tmp2);
+    }
+
+    /// !(dis <= max) also catches NaN and inf
+    const __m256 unreliable =
+        _mm256_or_ps(_mm256_cmp_ps(dis, v_max_dis, _CMP_NLE_UQ),
+                     _mm256_cmp_ps(dis, v_min_dis, _CMP_LT_OQ));
+
+    const __m256 nx = _mm256_loadu_ps(x + i + 1);
+    const __m256 ny = _mm256_loadu_ps(y + i + 1);
+    const __m256 nz = _mm256_loadu_ps(z + i + 1);
+    const __m256 lx = _mm256_loadu_ps(x + i - 1);
+    const __m256 ly = _mm256_loadu_ps(y + i - 1);
+    const __m256 lz = _mm256_loadu_ps(z + i - 1);
+    const __m256 diff = Norm2(_mm256_sub_ps(nx, px), _mm256_sub_ps(ny, py),
+                              _mm256_sub_ps(nz, pz));
+    const __m256 diff2 = Norm2(_mm256_sub_ps(px, lx), _mm256_sub_ps(py, ly),
+                               _mm256_sub_ps(pz, lz));
+    __m256d diff_lo, diff_hi, diff2_lo, diff2_hi, dis2_lo, dis2_hi;
+    ToDouble(diff, &diff_lo, &diff_hi);
+    ToDouble(diff2, &diff2_lo, &diff2_hi);
+    ToDouble(dis2, &dis2_lo, &dis2_hi);
+    const __m256d thr_lo = _mm256_mul_pd(v_ratio, dis2_lo);
+    const __m256d thr_hi = _mm256_mul_pd(v_ratio, dis2_hi);
+    const int occluded_lo = _mm256_movemask_pd(
+        _mm256_and_pd(_mm256_cmp_pd(diff_lo, thr_lo, _CMP_GT_OQ),
+                      _mm256_cmp_pd(diff2_lo, thr_lo, _CMP_GT_OQ)));
+    const int occluded_hi = _mm256_movemask_pd(
+        _mm256_and_pd(_mm256_cmp_pd(diff_hi, thr_hi, _CMP_GT_OQ),
+                      _mm256_cmp_pd(diff2_hi, thr_hi, _CMP_GT_OQ)));
+
+    StoreFlags(i, 8, _mm256_movemask_ps(unreliable),
+               occluded_lo | (occluded_hi << 4), neighbor_picked, label);
+  }
+  return i;
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+inline float32x4_t Norm2(float32x4_t x, float32x4_t y, float32x4_t z) {
+  return vaddq_f32(vaddq_f32(vmulq_f32(x, x), vmulq_f32(y, y)),
+                   vmulq_f32(z, z));
+}
+
+inline int MoveMask(uint32x4_t m) {
+  return (vgetq_lane_u32(m, 0) & 1) | (vgetq_lane_u32(m, 1) & 2) |
+         (vgetq_lane_u32(m, 2) & 4) | (vgetq_lane_u32(m, 3) & 8);
+}
+
+inline int MoveMask(uint64x2_t m) {
+  return static_cast<int>((vgetq_lane_u64(m, 0) & 1) |
+                          (vgetq_lane_u64(m, 1) & 2));
+}
+
+/// Processes full blocks of 4 points from begin on, returns the first
+/// unprocessed index. The specialized versions stop at the block in which
+/// the window switches.
+template <int kWin>
+int ComputeCurvatureSimd(const float *x, const float *y, const float *z,
+                         int begin, int end, int occlusion_end, bool normalize,
+                         int *win, float *curvature, int *neighbor_picked,
+                         int *label) {
+  const float32x4_t v_far = vdupq_n_f32(kDistanceFaraway);
+  const float32x4_t v_max_dis = vdupq_n_f32(kMaxFeatureDis);
+  const float32x4_t v_min_dis = vdupq_n_f32(MinFeatureDisF());
+  const float64x2_t v_eps = vdupq_n_f64(1e-3);
+  const float64x2_t v_ratio = vdupq_n_f64(kOcclusionRatio);
+
+  /// Whole blocks only, all of their points take the occlusion test
+  const int block_end = std::min(end, occlusion_end);
+  int i = begin;
+  for (; i + 4 <= block_end; i += 4) {
+    const float32x4_t px = vld1q_f32(x + i);
+    const float32x4_t py = vld1q_f32(y + i);
+    const float32x4_t pz = vld1q_f32(z + i);
+    const float32x4_t dis2 = Norm2(px, py, pz);
+    const float32x4_t dis = vsqrtq_f32(dis2);
+
+    /// The window switches inside this block, keep the exact point order
+    if (*win != kNumCurvSizeFar && vmaxvq_u32(vcgtq_f32(dis, v_far))) {
+      if (kWin != 0) break;
+      for (int k = 0; k < 4; ++k) {
+        ComputeCurvatureAt<0>(x, y, z, occlusion_end, i + k, normalize, win,
+                              curvature, neighbor_picked, label);
+      }
+      continue;
+    }
+
+    const int w = kWin > 0 ? kWin : *win;
+    float32x4_t diffX = vdupq_n_f32(0);
+    float32x4_t diffY = vdupq_n_f32(0);
+    float32x4_t diffZ = vdupq_n_f32(0);
+    for (int j = 1; j <= w; ++j) {
+      diffX = vaddq_f32(diffX, vaddq_f32(vld1q_f32(x + i - j),
+                                         vld1q_f32(x + i + j)));
+      diffY = vaddq_f32(diffY, vaddq_f32(vld1q_f32(y + i - j),
+                                         vld1q_f32(y + i + j)));
+      diffZ = vaddq_f32(diffZ, vaddq_f32(vld1q_f32(z + i - j),
+                                         vld1q_f32(z + i + j)));
+    }
+    const float32x4_t v_2w = vdupq_n_f32(static_cast<float>(2 * w));
+    diffX = vsubq_f32(diffX, vmulq_f32(v_2w, px));
+    diffY = vsubq_f32(diffY, vmulq_f32(v_2w, py));
+    diffZ = vsubq_f32(diffZ, vmulq_f32(v_2w, pz));
+    const float32x4_t tmp2 = Norm2(diffX, diffY, diffZ);
+
+    if (normalize) {
+      const float32x4_t tmp = vsqrtq_f32(tmp2);
+      const float32x4_t den = vmulq_f32(v_2w, dis);
+      const float64x2_t curv_lo =
+          vdivq_f64(vcvt_f64_f32(vget_low_f32(tmp)),
+                    vaddq_f64(vcvt_f64_f32(vget_low_f32(den)), v_eps));
+      const float64x2_t curv_hi = vdivq_f64(
+          vcvt_high_f64_f32(tmp), vaddq_f64(vcvt_high_f64_f32(den), v_eps));
+      vst1q_f32(curvature + i,
+                vcvt_high_f32_f64(vcvt_f32_f64(curv_lo), curv_hi));
+    } else {
+      vst1q_f32(curvature + i, tmp2);
+    }
+
+    /// !(dis <= max) also catches NaN and inf
+    const uint32x4_t unreliable =
+        vorrq_u32(vmvnq_u32(vcleq_f32(dis, v_max_dis)),
+                  vcltq_f32(dis, v_min_dis));
+
+    const float32x4_t diff =
+        Norm2(vsubq_f32(vld1q_f32(x + i + 1), px),
+              vsubq_f32(vld1q_f32(y + i + 1), py),
+              vsubq_f32(vld1q_f32(z + i + 1), pz));
+    const float32x4_t diff2 =
+        Norm2(vsubq_f32(px, vld1q_f32(x + i - 1)),
+              vsubq_f32(py, vld1q_f32(y + i - 1)),
+              vsubq_f32(pz, vld1q_f32(z + i - 1)));
+    const float64x2_t thr_lo =
+        vmulq_f64(v_ratio, vcvt_f64_f32(vget_low_f32(dis2)));
+    const float64x2_t thr_hi = vmulq_f64(v_ratio, vcvt_high_f64_f32(dis2));
+    const int occluded_lo = MoveMask(
+        vandq_u64(vcgtq_f64(vcvt_f64_f32(vget_low_f32(diff)), thr_lo),
+                  vcgtq_f64(vcvt_f64_f32(vget_low_f32(diff2)), thr_lo)));
+    const int occluded_hi =
+        MoveMask(vandq_u64(vcgtq_f64(vcvt_high_f64_f32(diff), thr_hi),
+                           vcgtq_f64(vcvt_high_f64_f32(diff2), thr_hi)));
+
+    StoreFlags(i, 4, MoveMask(unreliable), occluded_lo | (occluded_hi << 2),
+               neighbor_picked, label);
+  }
+  return i;
+}
+
+#endif
+
+/// Computes [begin, end) with the kernel for window kWin until the window
+/// switches, returns where it stopped
+template <int kWin>
+int ComputeCurvatureRun(const float *x, const float *y, const float *z,
+                        int begin, int end, int occlusion_end, bool normalize,
+                        int *win, float *curvature, int *neighbor_picked,
+                        int *label) {
+  int i = begin;
+#ifdef CURVATURE_KERNEL_SIMD
+  i = ComputeCurvatureSimd<kWin>(x, y, z, begin, end, occlusion_end,
+                                 normalize, win, curvature, neighbor_picked,
+                                 label);
+#endif
+  for (; i < end; i++) {
+    if (!ComputeCurvatureAt<kWin>(x, y, z, occlusion_end, i, normalize, win,
+                                  curvature, neighbor_picked, label)) {
+      break;
+    }
+  }
+  return i;
+}
+
+}  // namespace
+
+int ComputeCurvature(const float *x, const float *y, const float *z, int n,
+                     bool normalize, float *curvature, int *neighbor_picked,
+                     int *label, bool specialized) {
+  int win = kNumCurvSize;
+  ComputeCurvatureRange(x, y, z, kCurvatureMargin, n - kCurvatureMargin,
+                        n - kCurvatureMargin - 1, normalize, &win, curvature,
+                        neighbor_picked, label, specialized);
+  return win;
+}
+
+void ComputeCurvatureRange(const float *x, const float *y, const float *z,
+                           int begin, int end, int occlusion_end,
+                           bool normalize, int *win, float *curvature,
+                           int *neighbor_picked, int *label,
+                           bool specialized) {
+  if (!specialized) {
+    ComputeCurvatureRun<0>(x, y, z, begin, end, occlusion_end, normalize, win,
+                           curvature, neighbor_picked, label);
+    return;
+  }
+  /// A specialized run stops at the point switching the window, which the
+  /// generic code takes before the run of the new window goes on
+  int i = begin;
+  while (i < end) {
+    switch (*win) {
+      case kNumCurvSize:
+        i = ComputeCurvatureRun<kNumCurvSize>(x, y, z, i, end, occlusion_end,
+                                              normalize, win, curvature,
+                                              neighbor_picked, label);
+        break;
+      case kNumCurvSizeFar:
+        i = ComputeCurvatureRun<kNumCurvSizeFar>(
+            x, y, z, i, end, occlusion_end, normalize, win, curvature,
+            neighbor_picked, label);
+        break;
+      default:
+        i = ComputeCurvatureRun<0>(x, y, z, i, end, occlusion_end, normalize,
+                                   win, curvature, neighbor_picked, label);
+        break;
+    }
+    if (i < end) {
+      ComputeCurvatureAt<0>(x, y, z, occlusion_end, i, normalize, win,
+                            curvature, neighbor_picked, label);
+      i++;
+    }
+  }
+}
@@ -0,0 +1,58 @@
+#include "feature_extractor/feature_budget.h"
+
+#include <algorithm>
+#include <cmath>
+
+FeatureBudgetController::FeatureBudgetController(
+    const FeatureBudgetConfig &config, const FeatureQuota &base_quota)
+    : config_(config), base_quota_(base_quota), quota_(base_quota) {
+  /// The scale range that can still move at least one quota
+  min_scale_ = std::min({1.0 * config_.min_quota.num_edge /
+                             std::max(base_quota_.num_edge, 1),
+                         1.0 * config_.min_quota.num_less_edge /
+                             std::max(base_quota_.num_less_edge, 1),
+                         1.0 * config_.min_quota.num_flat /
+                             std::max(base_quota_.num_flat, 1)});
+  max_scale_ = std::max({1.0 * config_.max_quota.num_edge /
+                             std::max(base_quota_.num_edge, 1),
+                         1.0 * config_.max_quota.num_less_edge /
+                             std::max(base_quota_.num_less_edge, 1),
+                         1.0 * config_.max_quota.num_flat /
+                             std::max(base_quota_.num_flat, 1)});
+}
+
+const FeatureQuota &FeatureBudgetController::Update() {
+  double latency = latency_ms();
+  if (latency <= 0 || config_.target_ms <= 0) return quota_;
+
+  double error = (config_.target_ms - latency) / config_.target_ms;
+  if (std::fabs(error) > config_.deadband) {
+    scale_ *= 1 + config_.gain * std::max(-1.0, std::min(1.0, error));
+    scale_ = std::max(min_scale_, std::min(max_scale_, scale_));
+  }
+
+  quota_.num_edge = Scaled(base_quota_.num_edge, config_.min_quota.num_edge,
+                           config_.max_quota.num_edge);
+  quota_.num_less_edge =
+      Scaled(base_quota_.num_less_edge, config_.min_quota.num_less_edge,
+             config_.max_quota.num_less_edge);
+  quota_.num_flat = Scaled(base_quota_.num_flat, config_.min_quota.num_flat,
+                           config_.max_quota.num_flat);
+  /// The less-edge cap counts the edge points too
+  quota_.num_less_edge = std::max(quota_.num_less_edge, quota_.num_edge);
+  return quota_;
+}
+
+void FeatureBudgetController::Smooth(double ms, StageTime *smoothed) const {
+  if (!smoothed->initialized) {
+    smoothed->ms = ms;
+    smoothed->initialized = true;
+  } else {
+    smoothed->ms += config_.smoothing * (ms - smoothed->ms);
+  }
+}
+
+int FeatureBudgetController::Scaled(int base, int min_num, int max_num) const {
+  int num = std::lround(base * scale_);
+  return std::max(min_num, std::min(max_num, num));
+}
@@ -0,0 +1,464 @@
+#include "feature_extractor/feature_extractor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+#include "feature_extractor/curvature_kernel.h"
+#include "loam_horizon/tic_toc.h"
+
+namespace {
+
+constexpr int kNumRegion = 50;       // 6
+constexpr int kNumEdgeNeighbor = 5;  // 5;
+constexpr int kNumFlatNeighbor = 5;  // 5;
+constexpr float kThresholdSharpRaw = 50;  // 0.1;
+constexpr float kThresholdFlatRaw = 30;   // 0.1;
+constexpr float kThresholdLessflat = 0.1;
+
+void Append(std::vector<uint32_t> *to, const std::vector<uint32_t> &from) {
+  to->insert(to->end(), from.begin(), from.end());
+}
+
+}  // namespace
+
+void FeatureSet::clear() {
+  corner_sharp.clear();
+  corner_less_sharp.clear();
+  surf_flat.clear();
+  surf_less_flat.clear();
+  corner_sharp_ind.clear();
+  corner_less_sharp_ind.clear();
+  surf_flat_ind.clear();
+  surf_less_flat_ind.clear();
+}
+
+FeatureExtractor::FeatureExtractor(const FeatureExtractorConfig &config) {
+  set_config(config);
+}
+
+void FeatureExtractor::set_config(const FeatureExtractorConfig &config) {
+  config_ = config;
+  if (config_.num_threads > 1) {
+    if (!pool_ || pool_->size() != config_.num_threads) {
+      pool_.reset(new ThreadPool(config_.num_threads));
+    }
+  } else {
+    pool_.reset();
+  }
+}
+
+void FeatureExtractor::Extract(const PointType *points,
+                               const std::vector<int> &line_size,
+                               FeatureSet *features) {
+  const int cloudSize = Layout(line_size);
+
+  /// Curvature, un-reliable and occluded points in one pass over x/y/z
+  for (int i = 0; i < cloudSize; i++) {
+    x_[i] = points[i].x;
+    y_[i] = points[i].y;
+    z_[i] = points[i].z;
+  }
+  int curv_size = ComputeCurvature(
+      x_.data(), y_.data(), z_.data(), cloudSize, config_.normalize_curv,
+      curvature_.data(), neighbor_picked_.data(), label_.data(),
+      config_.specialized_kernels);
+
+  ExtractLines(points, line_size, curv_size, features);
+}
+
+int FeatureExtractor::Layout(const std::vector<int> &line_size) {
+  const int num_lines = line_size.size();
+  scan_start_ind_.resize(num_lines);
+  scan_end_ind_.resize(num_lines);
+  int cloudSize = 0;
+  for (int i = 0; i < num_lines; i++) {
+    scan_start_ind_[i] = cloudSize + 5;
+    cloudSize += line_size[i];
+    scan_end_ind_[i] = cloudSize - 6;
+  }
+
+  /// Grow the workspace, never shrink it
+  x_.resize(cloudSize);
+  y_.resize(cloudSize);
+  z_.resize(cloudSize);
+  curvature_.resize(cloudSize);
+  sort_ind_.resize(cloudSize);
+  neighbor_picked_.resize(cloudSize);
+  label_.resize(cloudSize);
+  if (lines_.size() < line_size.size()) lines_.resize(num_lines);
+  return cloudSize;
+}
+
+void FeatureExtractor::ExtractLines(const PointType *points,
+                                    const std::vector<int> &line_size,
+                                    int curv_size, FeatureSet *features) {
+  features->clear();
+  t_q_sort_ = 0;
+  const int num_lines = line_size.size();
+
+  /// debug
+  const int num_extract = config_.only_first_scan ? std::min(num_lines, 1)
+                                                  : num_lines;
+  auto extract_line = [&](int i) {
+    lines_[i].valid = scan_end_ind_[i] - scan_start_ind_[i] >= curv_size;
+    if (lines_[i].valid) {
+      ExtractLine(points, scan_start_ind_[i], scan_end_ind_[i], &lines_[i]);
+    }
+  };
+  if (pool_) {
+    pool_->ParallelFor(num_extract, extract_line);
+  } else {
+    for (int i = 0; i < num_extract; i++) extract_line(i);
+  }
+
+  /// Merge in line order, the less-sharp / less-flat clouds take the
+  /// sharp / flat points of all the lines so far, as the serial loop did
+  for (int i = 0; i < num_extract; i++) {
+    const LineFeatures &line = lines_[i];
+    if (!line.valid) continue;
+    t_q_sort_ += line.t_q_sort;
+
+    features->corner_sharp += line.corner_sharp;
+    features->corner_less_sharp += line.corner_less_sharp;
+    features->surf_flat += line.surf_flat;
+    Append(&features->corner_sharp_ind, line.corner_sharp_ind);
+    Append(&features->corner_less_sharp_ind, line.corner_less_sharp_ind);
+    Append(&features->surf_flat_ind, line.surf_flat_ind);
+
+    features->surf_less_flat += features->surf_flat;
+    features->corner_less_sharp += features->corner_sharp;
+    Append(&features->surf_less_flat_ind, features->surf_flat_ind);
+    Append(&features->corner_less_sharp_ind, features->corner_sharp_ind);
+    if (config_.downsample_less_flat) {
+      features->surf_less_flat += line.less_flat_scan_ds;
+      Append(&features->surf_less_flat_ind, line.less_flat_scan_ds_ind);
+    } else {
+      features->surf_less_flat += *line.less_flat_scan;
+      Append(&features->surf_less_flat_ind, line.less_flat_scan_ind);
+    }
+  }
+}
+
+void FeatureExtractor::BeginFrame(int num_lines) {
+  if ((int)streams_.size() < num_lines) streams_.resize(num_lines);
+  num_stream_lines_ = num_lines;
+  for (int l = 0; l < num_lines; l++) {
+    LineStream &line = streams_[l];
+    line.points.clear();
+    line.x.clear();
+    line.y.clear();
+    line.z.clear();
+    line.done = 5;
+    line.win = kNumCurvSize;
+    line.first_far = std::numeric_limits<int>::max();
+  }
+}
+
+void FeatureExtractor::AppendPoint(int line, const PointType &pt) {
+  LineStream &stream = streams_[line];
+  const int p = stream.points.size();
+  stream.points.push_back(pt);
+  stream.x.push_back(pt.x);
+  stream.y.push_back(pt.y);
+  stream.z.push_back(pt.z);
+
+  /// The kernel only sees the first 5 points of the frame as neighbors, the
+  /// first 5 of the other lines can switch the window
+  if (line > 0 && p < 5 && stream.win != kNumCurvSizeFar &&
+      std::sqrt(pt.x * pt.x + pt.y * pt.y + pt.z * pt.z) > kDistanceFaraway) {
+    stream.win = kNumCurvSizeFar;
+    stream.first_far = p;
+  }
+}
+
+void FeatureExtractor::Update() {
+  for (int l = 0; l < num_stream_lines_; l++) {
+    LineStream &line = streams_[l];
+    const int end = (int)line.points.size() - 5;
+    if (end <= line.done) continue;
+
+    line.curvature.resize(end);
+    line.neighbor_picked.resize(end);
+    line.label.resize(end);
+    const int begin = line.done;
+    const int win = line.win;
+    ComputeCurvatureRange(line.x.data(), line.y.data(), line.z.data(), begin,
+                          end, end, config_.normalize_curv, &line.win,
+                          line.curvature.data(), line.neighbor_picked.data(),
+                          line.label.data(), config_.specialized_kernels);
+    line.done = end;
+    if (win != line.win) line.first_far = FirstFar(line, begin, end);
+  }
+}
+
+int FeatureExtractor::FirstFar(const LineStream &line, int begin, int end) {
+  for (int p = begin; p < end; p++) {
+    const float dis = std::sqrt(line.x[p] * line.x[p] + line.y[p] * line.y[p] +
+                                line.z[p] * line.z[p]);
+    if (dis > kDistanceFaraway) return p;
+  }
+  return std::numeric_limits<int>::max();
+}
+
+void FeatureExtractor::FinishFrame(PointCloudXYZI *cloud,
+                                   std::vector<int> *line_size,
+                                   FeatureSet *features) {
+  line_size->resize(num_stream_lines_);
+  for (int l = 0; l < num_stream_lines_; l++) {
+    (*line_size)[l] = streams_[l].points.size();
+  }
+  const int n = Layout(*line_size);
+  cloud->points.resize(n);
+  cloud->width = n;
+  cloud->height = 1;
+  cloud->is_dense = true;
+
+  int offset = 0;
+  for (int l = 0; l < num_stream_lines_; l++) {
+    const LineStream &line = streams_[l];
+    std::copy(line.points.points.begin(), line.points.points.end(),
+              cloud->points.begin() + offset);
+    std::copy(line.x.begin(), line.x.end(), x_.begin() + offset);
+    std::copy(line.y.begin(), line.y.end(), y_.begin() + offset);
+    std::copy(line.z.begin(), line.z.end(), z_.begin() + offset);
+    offset += line.points.size();
+  }
+
+  /// Walk the lines in frame order with the window the kernel would have,
+  /// keeping what the stream computed right and redoing the rest: the line
+  /// ends, whose windows reach into the next line, and the points a far
+  /// point of an earlier line would have switched to the small window.
+  auto compute = [&](int begin, int end, int *win) {
+    begin = std::max(begin, 5);
+    end = std::min(end, n - 5);
+    if (begin >= end) return;
+    ComputeCurvatureRange(x_.data(), y_.data(), z_.data(), begin, end, n - 6,
+                          config_.normalize_curv, win, curvature_.data(),
+                          neighbor_picked_.data(), label_.data(),
+                          config_.specialized_kernels);
+  };
+  int win = kNumCurvSize;
+  offset = 0;
+  for (int l = 0; l < num_stream_lines_; l++) {
+    const LineStream &line = streams_[l];
+    const int size = line.points.size();
+    const int start = offset;
+    offset += size;
+
+    /// The stream counted the first 5 points of a line as neighbors only
+    /// for lines after the first, which the layout has to agree with
+    if (l > 0 && start < 5) {
+      compute(start, offset, &win);
+      continue;
+    }
+    compute(start, std::min(start + 5, offset), &win);
+
+    /// Streamed points, the last one of the frame skips the occlusion test
+    const int body_end = std::max(5, std::min(line.done, n - 6 - start));
+    int redo_end = 5;
+    if (win == kNumCurvSizeFar) {
+      redo_end = std::max(5, std::min(line.first_far, body_end));
+    } else if (line.first_far < body_end) {
+      win = kNumCurvSizeFar;
+    }
+    /// redo_end can pass the end of a short line, no iterator is formed then
+    const int keep = body_end - redo_end;
+    if (keep > 0) {
+      std::copy_n(line.curvature.begin() + redo_end, keep,
+                  curvature_.begin() + start + redo_end);
+      std::copy_n(line.neighbor_picked.begin() + redo_end, keep,
+                  neighbor_picked_.begin() + start + redo_end);
+      std::copy_n(line.label.begin() + redo_end, keep,
+                  label_.begin() + start + redo_end);
+    }
+    if (redo_end > 5) {
+      int redo_win = kNumCurvSizeFar;
+      compute(start + 5, start + redo_end, &redo_win);
+    }
+
+    compute(start + body_end, offset, &win);
+  }
+
+  ExtractLines(cloud->points.data(), *line_size, win, features);
+}
+
+void FeatureExtractor::ExtractLine(const PointType *points, int start,
+                                   int end, LineFeatures *line) {
+  line->corner_sharp.clear();
+  line->corner_less_sharp.clear();
+  line->surf_flat.clear();
+  line->less_flat_scan->clear();
+  line->corner_sharp_ind.clear();
+  line->corner_less_sharp_ind.clear();
+  line->surf_flat_ind.clear();
+  line->less_flat_scan_ind.clear();
+  line->t_q_sort = 0;
+
+  for (int j = 0; j < kNumRegion; j++) {
+    int sp = start + (end - start) * j / kNumRegion;
+    int ep = start + (end - start) * (j + 1) / kNumRegion - 1;
+    if (ep < sp) continue;
+
+    ExtractRegion(points, sp, ep, line);
+  }
+
+  if (config_.downsample_less_flat) {
+    const float leaf = config_.less_flat_leaf_size;
+    line->less_flat_filter.setLeafSize(leaf, leaf, leaf);
+    line->less_flat_filter.Filter(line->less_flat_scan->points.data(),
+                                  line->less_flat_scan->size(),
+                                  &line->less_flat_scan_ds, &line->first);
+    line->less_flat_scan_ds_ind.clear();
+    for (int k : line->first) {
+      line->less_flat_scan_ds_ind.push_back(line->less_flat_scan_ind[k]);
+    }
+  }
+}
+
+void FeatureExtractor::ExtractRegion(const PointType *points, int sp, int ep,
+                                     LineFeatures *line) {
+  float kThresholdSharp = kThresholdSharpRaw;
+  float kThresholdFlat = kThresholdFlatRaw;
+  if (config_.normalize_curv) {
+    kThresholdSharp = config_.threshold_sharp;
+    kThresholdFlat = config_.threshold_flat;
+  }
+  const FeatureQuota &quota = config_.quota;
+  const float *curv = curvature_.data();
+  int *picked = neighbor_picked_.data();
+
+  TicToc t_tmp;
+  /// The largest curvature in sp ~ ep, an isolated peak is not reliable
+  int max_ind = sp;
+  for (int k = sp + 1; k <= ep; k++) {
+    if (!CurvatureLess{curv}(k, max_ind)) max_ind = k;
+  }
+  if (IsIsolatedPeak(sp, ep, max_ind, &line->peak_curv)) {
+    picked[max_ind] = 1;
+  }
+
+  /// Only sharp candidates are ordered, lazily, from large to small
+  int *sharp_heap = sort_ind_.data() + sp;
+  int sharp_num = 0;
+  for (int k = sp; k <= ep; k++) {
+    if (curv[k] > kThresholdSharp) sharp_heap[sharp_num++] = k;
+  }
+  std::make_heap(sharp_heap, sharp_heap + sharp_num, CurvatureLess{curv});
+  line->t_q_sort += t_tmp.toc();
+
+  int largestPickedNum = 0;
+  while (sharp_num > 0) {
+    std::pop_heap(sharp_heap, sharp_heap + sharp_num, CurvatureLess{curv});
+    int ind = sharp_heap[--sharp_num];
+
+    if (picked[ind] != 0) continue;
+
+    largestPickedNum++;
+    if (largestPickedNum <= quota.num_edge) {
+      label_[ind] = 2;
+      line->corner_sharp.push_back(points[ind]);
+      line->corner_less_sharp.push_back(points[ind]);
+      line->corner_sharp_ind.push_back(ind);
+      line->corner_less_sharp_ind.push_back(ind);
+    } else if (largestPickedNum <= quota.num_less_edge) {
+      label_[ind] = 1;
+      line->corner_less_sharp.push_back(points[ind]);
+      line->corner_less_sharp_ind.push_back(ind);
+    } else {
+      break;
+    }
+
+    picked[ind] = 1;
+    MarkNeighbors<kNumEdgeNeighbor>(ind);
+  }
+
+  /// Same for flat candidates, from small to large
+  TicToc t_flat;
+  int *flat_heap = sort_ind_.data() + sp;
+  int flat_num = 0;
+  for (int k = sp; k <= ep; k++) {
+    if (curv[k] < kThresholdFlat) flat_heap[flat_num++] = k;
+  }
+  std::make_heap(flat_heap, flat_heap + flat_num, CurvatureGreater{curv});
+  line->t_q_sort += t_flat.toc();
+
+  int smallestPickedNum = 0;
+  while (flat_num > 0) {
+    std::pop_heap(flat_heap, flat_heap + flat_num, CurvatureGreater{curv});
+    int ind = flat_heap[--flat_num];
+
+    if (picked[ind] != 0) continue;
+
+    label_[ind] = -1;
+    line->surf_flat.push_back(points[ind]);
+    line->surf_flat_ind.push_back(ind);
+    picked[ind] = 1;
+
+    smallestPickedNum++;
+    if (smallestPickedNum >= quota.num_flat) {
+      break;
+    }
+
+    MarkNeighbors<kNumFlatNeighbor>(ind);
+  }
+
+  for (int k = sp; k <= ep; k++) {
+    if (label_[k] <= 0 && curv[k] < kThresholdLessflat) {
+      line->less_flat_scan->push_back(points[k]);
+      line->less_flat_scan_ind.push_back(k);
+    }
+  }
+}
+
+/// Whether the largest curvature of [sp, ep] is more than 3 times the sum of
+/// all the others. The float sum is defined in descending curvature order, so
+/// it is only rebuilt that way when a double estimate is too close to call.
+bool FeatureExtractor::IsIsolatedPeak(int sp, int ep, int max_ind,
+                                      std::vector<float> *peak_curv) {
+  const float max_curv = curvature_[max_ind];
+  double sum_approx = 0;
+  for (int k = sp; k <= ep; k++) {
+    if (k != max_ind) sum_approx += curvature_[k];
+  }
+  double margin = 3 * sum_approx * (ep - sp + 2) * 1.2e-7;
+  if (std::isfinite(sum_approx)) {
+    if (max_curv > 3 * sum_approx + margin) return true;
+    if (max_curv < 3 * sum_approx - margin) return false;
+  }
+
+  peak_curv->clear();
+  for (int k = sp; k <= ep; k++) {
+    if (k != max_ind) peak_curv->push_back(curvature_[k]);
+  }
+  std::sort(peak_curv->begin(), peak_curv->end(), std::greater<float>());
+  float SumCurRegion = 0.0;
+  for (float c : *peak_curv) SumCurRegion += c;
+  return max_curv > 3 * SumCurRegion;
+}
+
+/// Marks the continuous neighbors of a picked feature on both sides
+template <int kNum>
+void FeatureExtractor::MarkNeighbors(int ind) {
+  for (int l = 1; l <= kNum; l++) {
+    float diffX = x_[ind + l] - x_[ind + l - 1];
+    float diffY = y_[ind + l] - y_[ind + l - 1];
+    float diffZ = z_[ind + l] - z_[ind + l - 1];
+    if (diffX * diffX + diffY * diffY + diffZ * diffZ > 0.02) {
+      break;
+    }
+
+    neighbor_picked_[ind + l] = 1;
+  }
+  for (int l = -1; l >= -kNum; l--) {
+    float diffX = x_[ind + l] - x_[ind + l + 1];
+    float diffY = y_[ind + l] - y_[ind + l + 1];
+    float diffZ = z_[ind + l] - z_[ind + l + 1];
+    if (diffX * diffX + diffY * diffY + diffZ * diffZ > 0.02) {
+      break;
+    }
+
+    neighbor_picked_[ind + l] = 1;
+  }
+}
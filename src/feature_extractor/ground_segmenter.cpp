@@ -0,0 +1,72 @@
+#include "feature_extractor/ground_segmenter.h"
+
+#include <cmath>
+
+GroundSegmenter::GroundSegmenter(const GroundSegmenterConfig &config)
+    : config_(config),
+      max_slope_tan_(std::tan(config.max_slope_deg * M_PI / 180)) {}
+
+int GroundSegmenter::Vertical(const RangeImage &image, int row, int col,
+                              int step) const {
+  for (int k = 1; k <= config_.search_rows; k++) {
+    const int r = row + k * step;
+    if (r < 0 || r >= image.rows()) return -1;
+    const int ind = image.At(r, col);
+    if (ind >= 0) return ind;
+  }
+  return -1;
+}
+
+bool GroundSegmenter::IsGround(const PointType *points,
+                               const RangeImage &image, int index) const {
+  const PointType &pt = points[index];
+  if (!(pt.z < config_.max_z)) return false;
+
+  int row, col;
+  if (!image.CellOf(index, &row, &col)) return false;
+  /// Rows grow downwards, below is the better neighbor on the ground
+  int other = Vertical(image, row, col, 1);
+  if (other < 0) other = Vertical(image, row, col, -1);
+  if (other < 0) return false;
+
+  const PointType &nb = points[other];
+  const float dxy = std::fabs(std::sqrt(pt.x * pt.x + pt.y * pt.y) -
+                              std::sqrt(nb.x * nb.x + nb.y * nb.y));
+  const float dz = std::fabs(pt.z - nb.z);
+  return dz <= max_slope_tan_ * dxy;
+}
+
+int GroundSegmenter::CapGroundFlat(const PointType *points,
+                                   const RangeImage &image,
+                                   FeatureSet *features) {
+  const int num_flat = features->surf_flat_ind.size();
+  is_ground_.resize(num_flat);
+  num_ground_flat_ = 0;
+  for (int i = 0; i < num_flat; i++) {
+    is_ground_[i] = IsGround(points, image, features->surf_flat_ind[i]);
+    num_ground_flat_ += is_ground_[i];
+  }
+
+  const int max_ground = config_.max_ground_flat;
+  if (max_ground < 0 || num_ground_flat_ <= max_ground) return 0;
+
+  /// Keeps ground point k when it crosses a multiple of the stride
+  kept_.clear();
+  kept_ind_.clear();
+  int ground_seen = 0;
+  for (int i = 0; i < num_flat; i++) {
+    if (is_ground_[i]) {
+      const int slot = ground_seen * max_ground / num_ground_flat_;
+      const int next = (ground_seen + 1) * max_ground / num_ground_flat_;
+      ground_seen++;
+      if (slot == next) continue;
+    }
+    kept_.push_back(features->surf_flat.points[i]);
+    kept_ind_.push_back(features->surf_flat_ind[i]);
+  }
+  const int dropped = num_flat - (int)kept_ind_.size();
+  std::swap(features->surf_flat.points, kept_.points);
+  features->surf_flat.width = features->surf_flat.points.size();
+  features->surf_flat_ind.swap(kept_ind_);
+  return dropped;
+}
@@ -0,0 +1,92 @@
+#include "feature_extractor/normal_estimator.h"
+
+#include <Eigen/Eigenvalues>
+#include <algorithm>
+
+NormalEstimator::NormalEstimator(const NormalEstimatorConfig &config)
+    : config_(config) {}
+
+int NormalEstimator::Estimate(PointType *points,
+                              const std::vector<int> &line_size,
+                              const RangeImage &image,
+                              const std::vector<uint32_t> &indices) {
+  line_offset_.resize(line_size.size() + 1);
+  line_offset_[0] = 0;
+  for (size_t i = 0; i < line_size.size(); i++) {
+    line_offset_[i + 1] = line_offset_[i] + line_size[i];
+  }
+
+  int num_estimated = 0;
+  for (uint32_t ind : indices) {
+    /// Lines are consecutive, the one holding ind starts at the last
+    /// offset not above it
+    const int line = std::upper_bound(line_offset_.begin(),
+                                      line_offset_.end(), (int)ind) -
+                     line_offset_.begin() - 1;
+    if (line < 0 || line >= (int)line_size.size()) continue;
+    if (EstimateOne(points, ind, line_offset_[line], line_offset_[line + 1],
+                    image)) {
+      num_estimated++;
+    }
+  }
+  return num_estimated;
+}
+
+bool NormalEstimator::EstimateOne(PointType *points, int index,
+                                  int line_start, int line_end,
+                                  const RangeImage &image) {
+  PointType &pt = points[index];
+  pt.normal_x = pt.normal_y = pt.normal_z = 0;
+
+  image.Neighbors(index, config_.image_radius, &neighbors_);
+  for (int k = std::max(line_start, index - config_.line_neighbors);
+       k < std::min(line_end, index + config_.line_neighbors + 1); k++) {
+    if (k != index) neighbors_.push_back(k);
+  }
+
+  const Eigen::Vector3f p(pt.x, pt.y, pt.z);
+  const float max_dist =
+      std::max(config_.min_distance, config_.distance_ratio * p.norm());
+  const float max_sq_dist = max_dist * max_dist;
+
+  /// The point itself is part of the neighborhood. A cross-line neighbor
+  /// may also be an in-line one, counting it twice only weights it more.
+  /// Sums are taken relative to the point, so far points keep their
+  /// precision in float.
+  Eigen::Vector3f sum = Eigen::Vector3f::Zero();
+  Eigen::Matrix3f sum_sq = Eigen::Matrix3f::Zero();
+  int num = 1;
+  int num_cross_line = 0;
+  for (int k : neighbors_) {
+    const Eigen::Vector3f d =
+        Eigen::Vector3f(points[k].x, points[k].y, points[k].z) - p;
+    if (d.squaredNorm() > max_sq_dist) continue;
+    sum += d;
+    sum_sq += d * d.transpose();
+    num++;
+    if (k < line_start || k >= line_end) num_cross_line++;
+  }
+  /// One line alone is collinear, it tells nothing about the surface
+  if (num < config_.min_neighbors ||
+      num_cross_line < config_.min_cross_line) {
+    return false;
+  }
+
+  const Eigen::Vector3f mean = sum / num;
+  const Eigen::Matrix3f cov = sum_sq / num - mean * mean.transpose();
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> saes;
+  saes.computeDirect(cov);
+  /// Eigenvalues are in increasing order
+  const Eigen::Vector3f lambda = saes.eigenvalues();
+  if (!(lambda(1) > 0)) return false;
+  const float planarity =
+      std::max(0.0f, std::min(1.0f, (lambda(1) - lambda(0)) / lambda(1)));
+
+  Eigen::Vector3f normal = saes.eigenvectors().col(0);
+  if (normal.dot(p) > 0) normal = -normal;
+  normal *= planarity;
+  pt.normal_x = normal.x();
+  pt.normal_y = normal.y();
+  pt.normal_z = normal.z();
+  return true;
+}
@@ -0,0 +1,65 @@
+#include "feature_extractor/range_image.h"
+
+#include <cmath>
+
+RangeImage::RangeImage(const RangeImageConfig &config) {
+  const float deg2rad = M_PI / 180;
+  h_half_rad_ = config.h_fov_deg / 2 * deg2rad;
+  v_half_rad_ = config.v_fov_deg / 2 * deg2rad;
+  inv_res_rad_ = 1 / (config.resolution_deg * deg2rad);
+  rows_ = std::ceil(config.v_fov_deg / config.resolution_deg);
+  cols_ = std::ceil(config.h_fov_deg / config.resolution_deg);
+  cells_.assign(rows_ * cols_, -1);
+  cell_range_.assign(rows_ * cols_, 0);
+}
+
+void RangeImage::Reset(int num_points) {
+  for (int cell : touched_) cells_[cell] = -1;
+  touched_.clear();
+  point_cell_.assign(num_points, -1);
+}
+
+bool RangeImage::Project(const PointType &pt, int *row, int *col) const {
+  const float xy = std::sqrt(pt.x * pt.x + pt.y * pt.y);
+  const float azimuth = std::atan2(pt.y, pt.x);
+  const float elevation = std::atan2(pt.z, xy);
+  if (!(std::fabs(azimuth) < h_half_rad_) ||
+      !(std::fabs(elevation) < v_half_rad_)) {
+    return false;
+  }
+  *col = (azimuth + h_half_rad_) * inv_res_rad_;
+  *row = (v_half_rad_ - elevation) * inv_res_rad_;
+  return *row >= 0 && *row < rows_ && *col >= 0 && *col < cols_;
+}
+
+bool RangeImage::Insert(const PointType &pt, int index) {
+  int row, col;
+  if (!Project(pt, &row, &col)) return false;
+
+  const int cell = row * cols_ + col;
+  const float range = pt.x * pt.x + pt.y * pt.y + pt.z * pt.z;
+  point_cell_[index] = cell;
+  if (cells_[cell] < 0) {
+    touched_.push_back(cell);
+  } else if (cell_range_[cell] <= range) {
+    return true;
+  }
+  cells_[cell] = index;
+  cell_range_[cell] = range;
+  return true;
+}
+
+int RangeImage::Neighbors(int index, int radius,
+                          std::vector<int> *neighbors) const {
+  neighbors->clear();
+  int row, col;
+  if (!CellOf(index, &row, &col)) return 0;
+
+  for (int r = row - radius; r <= row + radius; r++) {
+    for (int c = col - radius; c <= col + radius; c++) {
+      int ind = At(r, c);
+      if (ind >= 0 && ind != index) neighbors->push_back(ind);
+    }
+  }
+  return neighbors->size();
+}
@@ -0,0 +1,54 @@
+#include "feature_extractor/scan_ingest.h"
+
+#include <cmath>
+
+#include "loam_horizon/livox_point.h"
+
+void ScanIngest::Ingest(const LivoxPoint *points, int num_points,
+                        int num_lines, float min_range, PointCloudXYZI *cloud,
+                        std::vector<int> *line_size, RangeImage *image) {
+  point_line_.resize(num_points);
+  line_size->assign(num_lines, 0);
+  line_fill_.resize(num_lines);
+  int *size = line_size->data();
+  int *fill = line_fill_.data();
+
+  /// Count
+  for (int i = 0; i < num_points; ++i) {
+    const LivoxPoint &p = points[i];
+    point_line_[i] = -1;
+    if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) {
+      continue;
+    }
+    if (p.x * p.x + p.y * p.y + p.z * p.z < min_range * min_range) continue;
+    if (p.line >= num_lines) continue;
+    point_line_[i] = p.line;
+    size[p.line]++;
+  }
+
+  /// Fill, fill[l] walks from the start of line l to its end
+  int cloud_size = 0;
+  for (int l = 0; l < num_lines; l++) {
+    fill[l] = cloud_size;
+    cloud_size += size[l];
+  }
+  cloud->points.resize(cloud_size);
+  cloud->width = cloud_size;
+  cloud->height = 1;
+  cloud->is_dense = true;
+  if (image) image->Reset(cloud_size);
+
+  for (int i = 0; i < num_points; ++i) {
+    if (point_line_[i] < 0) continue;
+    const LivoxPoint &p = points[i];
+    const int index = fill[point_line_[i]]++;
+    PointType &point = cloud->points[index];
+    point.x = p.x;
+    point.y = p.y;
+    point.z = p.z;
+    point.intensity = p.line + p.t_offset;
+    point.curvature = p.reflectivity * 0.1f;
+    point.normal_x = point.normal_y = point.normal_z = 0;
+    if (image) image->Insert(point, index);
+  }
+}
@@ -0,0 +1,134 @@
+#include "feature_extractor/voxel_filter.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/// Voxel coordinate of a value, saturated instead of overflowing
+inline int32_t Cell(float v, float inv_leaf) {
+  const float c = std::floor(v * inv_leaf);
+  return c < -2147483520.f ? INT32_MIN
+                           : (c > 2147483520.f ? INT32_MAX : (int32_t)c);
+}
+
+inline uint32_t Hash(int32_t x, int32_t y, int32_t z) {
+  uint32_t h = (uint32_t)x * 73856093u ^ (uint32_t)y * 19349669u ^
+               (uint32_t)z * 83492791u;
+  /// The primes leave the low bits weak for neighboring cells, mix them in
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  return h;
+}
+
+}  // namespace
+
+void VoxelFilter::setLeafSize(float lx, float ly, float lz) {
+  inv_leaf_[0] = 1 / lx;
+  inv_leaf_[1] = 1 / ly;
+  inv_leaf_[2] = 1 / lz;
+}
+
+void VoxelFilter::filter(PointCloudXYZI &output) {
+  if (!input_) {
+    output.clear();
+    return;
+  }
+  Filter(input_->points.data(), input_->points.size(), &output);
+  output.header = input_->header;
+}
+
+void VoxelFilter::Reserve(int n) {
+  /// At most half full, so probe chains stay short
+  uint32_t capacity = 16;
+  while (capacity < 2u * n) capacity <<= 1;
+  if (capacity > slots_.size()) {
+    slots_.assign(capacity, Slot{0, 0, 0, -1});
+    mask_ = capacity - 1;
+  } else {
+    for (uint32_t i : used_) slots_[i].voxel = -1;
+  }
+  used_.clear();
+  num_voxels_ = 0;
+}
+
+int VoxelFilter::Find(int32_t x, int32_t y, int32_t z, bool *inserted) {
+  for (uint32_t i = Hash(x, y, z) & mask_;; i = (i + 1) & mask_) {
+    Slot &slot = slots_[i];
+    if (slot.voxel < 0) {
+      slot = Slot{x, y, z, num_voxels_++};
+      used_.push_back(i);
+      *inserted = true;
+      return slot.voxel;
+    }
+    if (slot.x == x && slot.y == y && slot.z == z) {
+      *inserted = false;
+      return slot.voxel;
+    }
+  }
+}
+
+void VoxelFilter::Filter(const PointType *points, int n,
+                         PointCloudXYZI *output, std::vector<int> *first) {
+  Reserve(n);
+  output->clear();
+  if (first) first->clear();
+  if (policy_ == kCentroid && (int)sums_.size() < n) sums_.resize(n);
+  if (policy_ == kFirstPoint) output->points.reserve(n);
+
+  for (int i = 0; i < n; i++) {
+    const PointType &pt = points[i];
+    if (!std::isfinite(pt.x) || !std::isfinite(pt.y) ||
+        !std::isfinite(pt.z)) {
+      continue;
+    }
+    bool inserted;
+    const int voxel =
+        Find(Cell(pt.x, inv_leaf_[0]), Cell(pt.y, inv_leaf_[1]),
+             Cell(pt.z, inv_leaf_[2]), &inserted);
+
+    if (inserted && first) first->push_back(i);
+    if (policy_ == kFirstPoint) {
+      if (inserted) output->points.push_back(pt);
+      continue;
+    }
+
+    if (inserted) {
+      sums_[voxel] = Sum{pt.x,        pt.y,        pt.z,        pt.intensity,
+                         pt.normal_x, pt.normal_y, pt.normal_z, pt.curvature,
+                         1};
+      continue;
+    }
+    Sum &sum = sums_[voxel];
+    sum.x += pt.x;
+    sum.y += pt.y;
+    sum.z += pt.z;
+    sum.intensity += pt.intensity;
+    sum.normal_x += pt.normal_x;
+    sum.normal_y += pt.normal_y;
+    sum.normal_z += pt.normal_z;
+    sum.curvature += pt.curvature;
+    sum.count++;
+  }
+
+  if (policy_ == kCentroid) {
+    output->points.resize(num_voxels_);
+    for (int v = 0; v < num_voxels_; v++) {
+      const Sum &sum = sums_[v];
+      const float inv = 1.0f / sum.count;
+      PointType &pt = output->points[v];
+      pt.x = sum.x * inv;
+      pt.y = sum.y * inv;
+      pt.z = sum.z * inv;
+      pt.intensity = sum.intensity * inv;
+      pt.normal_x = sum.normal_x * inv;
+      pt.normal_y = sum.normal_y * inv;
+      pt.normal_z = sum.normal_z * inv;
+      pt.curvature = sum.curvature * inv;
+    }
+  }
+  output->width = output->points.size();
+  output->height = 1;
+  output->is_dense = true;
+}
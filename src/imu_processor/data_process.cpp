@@ -6,23 +6,46 @@
 #include <pcl_conversions/pcl_conversions.h>
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
 #include <tf/transform_broadcaster.h>
 #include <cmath>
 
 #include <pcl/kdtree/kdtree_flann.h>
 #include <opencv2/opencv.hpp>
 
+#include "loam_horizon/lazy_publish.h"
+
 using Sophus::SE3d;
 using Sophus::SO3d;
 
-pcl::PointCloud<pcl::PointXYZINormal>::Ptr laserCloudtmp(
-    new pcl::PointCloud<pcl::PointXYZINormal>());
+PointCloudLivox::Ptr laserCloudtmp(new PointCloudLivox());
+
+/// Reads a cloud of livox_repub, one copy of its buffer. Returns false if
+/// it is not a LivoxPoint cloud.
+bool ReadLivoxCloud(const sensor_msgs::PointCloud2 &msg,
+                    PointCloudLivox *cloud) {
+  const LivoxPoint *points = LivoxPoints(msg);
+  if (!points) return false;
+  const int num_points = msg.width * msg.height;
+  cloud->points.assign(points, points + num_points);
+  cloud->width = num_points;
+  cloud->height = 1;
+  cloud->is_dense = msg.is_dense;
+  pcl_conversions::toPCL(msg.header, cloud->header);
+  return true;
+}
 
 ImuProcess::ImuProcess()
     : b_first_frame_(true), last_lidar_(nullptr), last_imu_(nullptr) {
   Eigen::Quaterniond q(1, 0, 0, 0);
   Eigen::Vector3d t(0, 0, 0);
   T_i_l = Sophus::SE3d(q, t);
+
+  pub_first_point_ =
+      nh.advertise<sensor_msgs::PointCloud2>("/livox_first_point", 100);
+  pub_undistort_ =
+      nh.advertise<sensor_msgs::PointCloud2>("/livox_undistort", 100);
+  pub_distort_ = nh.advertise<sensor_msgs::PointCloud2>("/livox_distort", 100);
 }
 
 ImuProcess::~ImuProcess() {}
@@ -36,8 +59,8 @@ void ImuProcess::Reset() {
 
   gyr_int_.Reset(-1, nullptr);
 
-  cur_pcl_in_.reset(new PointCloudXYZI());
-  cur_pcl_un_.reset(new PointCloudXYZI());
+  cur_pcl_in_.reset(new PointCloudLivox());
+  cur_pcl_un_.reset(new PointCloudLivox());
 }
 
 void ImuProcess::IntegrateGyr(
@@ -54,13 +77,12 @@ void ImuProcess::IntegrateGyr(
            gyr_int_.GetRot().angleZ() * 180.0 / M_PI);
 }
 
-void ImuProcess::UndistortPcl(const PointCloudXYZI::Ptr &pcl_in_out,
+void ImuProcess::UndistortPcl(const PointCloudLivox::Ptr &pcl_in_out,
                               double dt_be, const Sophus::SE3d &Tbe) {
   const Eigen::Vector3d &tbe = Tbe.translation();
   Eigen::Vector3d rso3_be = Tbe.so3().log();
   for (auto &pt : pcl_in_out->points) {
-    int ring = int(pt.intensity);
-    float dt_bi = pt.intensity - ring;
+    const float dt_bi = pt.t_offset;
 
     if (dt_bi == 0) laserCloudtmp->push_back(pt);
     double ratio_bi = dt_bi / dt_be;
@@ -122,48 +144,52 @@ void ImuProcess::Process(const MeasureGroup &meas) {
   dt_l_c_ =
       pcl_in_msg->header.stamp.toSec() - last_lidar_->header.stamp.toSec();
   //// Get input pcl
-  pcl::fromROSMsg(*pcl_in_msg, *cur_pcl_in_);
+  if (!ReadLivoxCloud(*pcl_in_msg, cur_pcl_in_.get())) {
+    ROS_WARN_THROTTLE(10, "lidar message without the livox_repub fields");
+    last_lidar_ = pcl_in_msg;
+    last_imu_ = meas.imu.back();
+    return;
+  }
 
-  /// Undistort points
+  /// Undistort points, only when someone takes them or the first points
+  const bool b_pub_first_point = HasSubscribers(pub_first_point_);
+  const bool b_pub_undistort = HasSubscribers(pub_undistort_);
 
-  Sophus::SE3d T_l_be = T_i_l.inverse() * T_l_c * T_i_l;
-  pcl::copyPointCloud(*cur_pcl_in_, *cur_pcl_un_);
-  UndistortPcl(cur_pcl_un_, dt_l_c_, T_l_be);
+  if (b_pub_undistort || b_pub_first_point) {
+    Sophus::SE3d T_l_be = T_i_l.inverse() * T_l_c * T_i_l;
+    pcl::copyPointCloud(*cur_pcl_in_, *cur_pcl_un_);
+    UndistortPcl(cur_pcl_un_, dt_l_c_, T_l_be);
+  }
 
-  {
-    static ros::Publisher pub_UndistortPcl =
-        nh.advertise<sensor_msgs::PointCloud2>("/livox_first_point", 100);
+  if (b_pub_first_point) {
     sensor_msgs::PointCloud2 pcl_out_msg;
     pcl::toROSMsg(*laserCloudtmp, pcl_out_msg);
     pcl_out_msg.header = pcl_in_msg->header;
     pcl_out_msg.header.frame_id = "/camera_init";
-    pub_UndistortPcl.publish(pcl_out_msg);
-    laserCloudtmp->clear();
+    pub_first_point_.publish(pcl_out_msg);
   }
+  laserCloudtmp->clear();
 
-  {
-    static ros::Publisher pub_UndistortPcl =
-        nh.advertise<sensor_msgs::PointCloud2>("/livox_undistort", 100);
+  if (b_pub_undistort) {
     sensor_msgs::PointCloud2 pcl_out_msg;
     pcl::toROSMsg(*cur_pcl_un_, pcl_out_msg);
     pcl_out_msg.header = pcl_in_msg->header;
     pcl_out_msg.header.frame_id = "/camera_init";
-    pub_UndistortPcl.publish(pcl_out_msg);
+    pub_undistort_.publish(pcl_out_msg);
   }
 
-  {
-    static ros::Publisher pub_UndistortPcl =
-        nh.advertise<sensor_msgs::PointCloud2>("/livox_distort", 100);
+  if (HasSubscribers(pub_distort_)) {
     sensor_msgs::PointCloud2 pcl_out_msg;
     pcl::toROSMsg(*cur_pcl_in_, pcl_out_msg);
     pcl_out_msg.header = pcl_in_msg->header;
     pcl_out_msg.header.frame_id = "/camera_init";
-    pub_UndistortPcl.publish(pcl_out_msg);
+    pub_distort_.publish(pcl_out_msg);
   }
+  LogUnconsumedBytes();
 
   /// Record last measurements
   last_lidar_ = pcl_in_msg;
   last_imu_ = meas.imu.back();
-  cur_pcl_in_.reset(new PointCloudXYZI());
-  cur_pcl_un_.reset(new PointCloudXYZI());
+  cur_pcl_in_.reset(new PointCloudLivox());
+  cur_pcl_un_.reset(new PointCloudLivox());
 }
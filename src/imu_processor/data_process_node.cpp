@@ -1,11 +1,9 @@
 #include <ros/ros.h>
-#include <condition_variable>
-#include <csignal>
 #include <deque>
-#include <mutex>
 #include <thread>
 
 #include "imu_processor/data_process.h"
+#include "loam_horizon/input_sync.h"
 
 /// *************Config data
 std::string topic_pcl = "/livox_pcl0";
@@ -13,9 +11,7 @@ std::string topic_imu = "/imu";
 /// *************
 
 /// To notify new data
-std::mutex mtx_buffer;
-std::condition_variable sig_buffer;
-bool b_exit = false;
+InputSync input_sync;
 bool b_reset = false;
 
 /// Buffers for measurements
@@ -24,28 +20,19 @@ std::deque<sensor_msgs::PointCloud2::ConstPtr> lidar_buffer;
 double last_timestamp_imu = -1;
 std::deque<sensor_msgs::Imu::ConstPtr> imu_buffer;
 
-void SigHandle(int sig) {
-  b_exit = true;
-  ROS_WARN("catch sig %d", sig);
-  sig_buffer.notify_all();
-}
-
 void pointcloud_cbk(const sensor_msgs::PointCloud2::ConstPtr &msg) {
   const double timestamp = msg->header.stamp.toSec();
   // ROS_DEBUG("get point cloud at time: %.6f", timestamp);
 
-  mtx_buffer.lock();
-
-  if (timestamp < last_timestamp_lidar) {
-    ROS_ERROR("lidar loop back, clear buffer");
-    lidar_buffer.clear();
-  }
-  last_timestamp_lidar = timestamp;
-
-  lidar_buffer.push_back(msg);
+  input_sync.Push([&] {
+    if (timestamp < last_timestamp_lidar) {
+      ROS_ERROR("lidar loop back, clear buffer");
+      lidar_buffer.clear();
+    }
+    last_timestamp_lidar = timestamp;
 
-  mtx_buffer.unlock();
-  sig_buffer.notify_all();
+    lidar_buffer.push_back(msg);
+  });
 }
 
 void imu_cbk(const sensor_msgs::Imu::ConstPtr &msg_in) {
@@ -54,19 +41,16 @@ void imu_cbk(const sensor_msgs::Imu::ConstPtr &msg_in) {
   double timestamp = msg->header.stamp.toSec();
   // ROS_DEBUG("get imu at time: %.6f", timestamp);
 
-  mtx_buffer.lock();
-
-  if (timestamp < last_timestamp_imu) {
-    ROS_ERROR("imu loop back, clear buffer");
-    imu_buffer.clear();
-    b_reset = true;
-  }
-  last_timestamp_imu = timestamp;
-
-  imu_buffer.push_back(msg);
+  input_sync.Push([&] {
+    if (timestamp < last_timestamp_imu) {
+      ROS_ERROR("imu loop back, clear buffer");
+      imu_buffer.clear();
+      b_reset = true;
+    }
+    last_timestamp_imu = timestamp;
 
-  mtx_buffer.unlock();
-  sig_buffer.notify_all();
+    imu_buffer.push_back(msg);
+  });
 }
 
 bool SyncMeasure(MeasureGroup &measgroup) {
@@ -113,35 +97,30 @@ bool SyncMeasure(MeasureGroup &measgroup) {
 void ProcessLoop(std::shared_ptr<ImuProcess> p_imu) {
   ROS_INFO("Start ProcessLoop");
 
-  ros::Rate r(1000);
   while (ros::ok()) {
     MeasureGroup meas;
-    std::unique_lock<std::mutex> lk(mtx_buffer);
-    sig_buffer.wait(lk,
-                    [&meas]() -> bool { return SyncMeasure(meas) || b_exit; });
-    lk.unlock();
-
-    if (b_exit) {
-      ROS_INFO("b_exit=true, exit");
+    bool reset = false;
+    if (!input_sync.Wait([&] {
+          reset = b_reset;
+          b_reset = false;
+          return SyncMeasure(meas) || reset;
+        })) {
+      ROS_INFO("shutdown, exit");
       break;
     }
 
-    if (b_reset) {
+    if (reset) {
       ROS_WARN("reset when rosbag play back");
       p_imu->Reset();
-      b_reset = false;
       continue;
     }
     p_imu->Process(meas);
-
-    r.sleep();
   }
 }
 
 int main(int argc, char **argv) {
   ros::init(argc, argv, "data_process");
   ros::NodeHandle nh;
-  signal(SIGINT, SigHandle);
 
   ros::Subscriber sub_pcl = nh.subscribe(topic_pcl, 100, pointcloud_cbk);
   ros::Subscriber sub_imu = nh.subscribe(topic_imu, 1000, imu_cbk);
@@ -166,14 +145,7 @@ int main(int argc, char **argv) {
 
   std::thread th_proc(ProcessLoop, p_imu);
 
-  // ros::spin();
-  ros::Rate r(1000);
-  while (ros::ok()) {
-    if (b_exit) break;
-
-    ros::spinOnce();
-    r.sleep();
-  }
+  ros::spin();
 
   ROS_INFO("Wait for process loop exit");
   if (th_proc.joinable()) th_proc.join();
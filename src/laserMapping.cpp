@@ -43,7 +43,6 @@
 #include <math.h>
 #include <nav_msgs/Odometry.h>
 #include <nav_msgs/Path.h>
-#include <pcl/filters/voxel_grid.h>
 #include <pcl/kdtree/kdtree_flann.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -52,6 +51,7 @@
 #include <ros/ros.h>
 #include <sensor_msgs/Imu.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <std_msgs/Float64.h>
 #include <tf/transform_broadcaster.h>
 #include <tf/transform_datatypes.h>
 #include <eigen3/Eigen/Dense>
@@ -68,8 +68,12 @@
 #include <cv_bridge/cv_bridge.h>
 
 
+#include "feature_extractor/normal_estimator.h"
+#include "feature_extractor/voxel_filter.h"
 #include "lidarFactor.hpp"
 #include "loam_horizon/common.h"
+#include "loam_horizon/input_sync.h"
+#include "loam_horizon/lazy_publish.h"
 #include "loam_horizon/tic_toc.h"
 
 int frameCount = 0;
@@ -149,13 +153,20 @@ std::queue<sensor_msgs::PointCloud2ConstPtr> cornerLastBuf;
 std::queue<sensor_msgs::PointCloud2ConstPtr> surfLastBuf;
 std::queue<sensor_msgs::PointCloud2ConstPtr> fullResBuf;
 std::queue<nav_msgs::Odometry::ConstPtr> odometryBuf;
-std::mutex mBuf;
+InputSync input_sync;
 std::mutex mOdom;
 std::mutex mCam;
 
 
-pcl::VoxelGrid<PointType> downSizeFilterCorner;
-pcl::VoxelGrid<PointType> downSizeFilterSurf;
+VoxelFilter downSizeFilterCorner;
+VoxelFilter downSizeFilterSurf;
+
+/// Use the normals shipped by scanRegistration: map points keep them
+/// rotated to the world, weak surf points and correspondences across
+/// differently oriented surfaces are dropped before the plane fit
+bool USE_POINT_NORMALS = false;
+float MIN_PLANARITY = 0.2;
+float MIN_NORMAL_COS = 0.866;  // 30 deg
 
 std::vector<int> pointSearchInd;
 std::vector<float> pointSearchSqDis;
@@ -164,6 +175,36 @@ PointType pointOri, pointSel;
 
 ros::Publisher pubLaserCloudSurround, pubLaserCloudMap, pubLaserCloudFullRes,
     pubOdomAftMapped, pubOdomAftMappedHighFrec, pubLaserAfterMappedPath, pubLaserColor;
+/// Per-frame mapping time, feedback for the feature budget of scanRegistration
+ros::Publisher pubMappingTime;
+
+/// Latency from the stamp of a frame to the publication of its mapped pose,
+/// on the ROS clock, over the frames since the last log line. The stamps are
+/// lidar time: unless the lidar is synchronized to the ROS clock they carry
+/// a constant offset, which the minimum then holds, and mean - min is the
+/// part that varies from frame to frame.
+struct StampLatency {
+  double sum_ms = 0, min_ms = 0, max_ms = 0;
+  int frames = 0;
+  ros::WallTime last_log = ros::WallTime::now();
+
+  void Add(const ros::Time &stamp) {
+    const double ms = (ros::Time::now() - stamp).toSec() * 1e3;
+    ROS_DEBUG("stamp to output latency %f ms", ms);
+    min_ms = frames ? std::min(min_ms, ms) : ms;
+    max_ms = frames ? std::max(max_ms, ms) : ms;
+    sum_ms += ms;
+    frames++;
+    const ros::WallTime now = ros::WallTime::now();
+    if ((now - last_log).toSec() < 10) return;
+    ROS_INFO("stamp to output latency over %d frames: mean %.2f ms, "
+             "min %.2f ms, max %.2f ms",
+             frames, sum_ms / frames, min_ms, max_ms);
+    *this = StampLatency();
+    last_log = now;
+  }
+};
+StampLatency stamp_latency;
 
 nav_msgs::Path laserAfterMappedPath;
 
@@ -725,6 +766,13 @@ void pointAssociateToMap(PointType const *const pi, PointType *const po) {
   po->z = point_w.z();
   po->intensity = pi->intensity;
   // po->intensity = 1.0;
+  if (USE_POINT_NORMALS) {
+    Eigen::Vector3d normal_w =
+        q_w_curr * Eigen::Vector3d(pi->normal_x, pi->normal_y, pi->normal_z);
+    po->normal_x = normal_w.x();
+    po->normal_y = normal_w.y();
+    po->normal_z = normal_w.z();
+  }
 }
 
 void IntensityAssociateToMap(PointType const *const pi, pcl::PointXYZINormal *const po) {
@@ -787,27 +835,20 @@ void pointAssociateTobeMapped(PointType const *const pi, PointType *const po) {
 
 void laserCloudCornerLastHandler(
     const sensor_msgs::PointCloud2ConstPtr &laserCloudCornerLast2) {
-  mBuf.lock();
-  cornerLastBuf.push(laserCloudCornerLast2);
-  mBuf.unlock();
+  input_sync.Push([&] { cornerLastBuf.push(laserCloudCornerLast2); });
 }
 
 void laserCloudSurfLastHandler(
     const sensor_msgs::PointCloud2ConstPtr &laserCloudSurfLast2) {
-  mBuf.lock();
-  surfLastBuf.push(laserCloudSurfLast2);
-  mBuf.unlock();
+  input_sync.Push([&] { surfLastBuf.push(laserCloudSurfLast2); });
 }
 
 void laserCloudFullResHandler(
     const sensor_msgs::PointCloud2ConstPtr &laserCloudFullRes2) {
-  mBuf.lock();
-
   // print msg header info:
   std::cout << "header time: " << laserCloudFullRes2->header.stamp << std::endl;
 
-  fullResBuf.push(laserCloudFullRes2);
-  mBuf.unlock();
+  input_sync.Push([&] { fullResBuf.push(laserCloudFullRes2); });
 }
 
 void cameraHandler(
@@ -831,9 +872,7 @@ void cameraHandler(
 
 // receive odomtry
 void laserOdometryHandler(const nav_msgs::Odometry::ConstPtr &laserOdometry) {
-  mBuf.lock();
-  odometryBuf.push(laserOdometry);
-  mBuf.unlock();
+  input_sync.Push([&] { odometryBuf.push(laserOdometry); });
 
   // high frequence publish
   Eigen::Quaterniond q_wodom_curr;
@@ -860,86 +899,83 @@ void laserOdometryHandler(const nav_msgs::Odometry::ConstPtr &laserOdometry) {
   odomAftMapped.pose.pose.position.x = t_w_curr.x();
   odomAftMapped.pose.pose.position.y = t_w_curr.y();
   odomAftMapped.pose.pose.position.z = t_w_curr.z();
-  pubOdomAftMappedHighFrec.publish(odomAftMapped);
+  PublishTracked(pubOdomAftMappedHighFrec, odomAftMapped);
 }
 
-void process() {
-  while (1) {
-    while (!cornerLastBuf.empty() && !surfLastBuf.empty() &&
-           !fullResBuf.empty() && !odometryBuf.empty()) {
-      mBuf.lock();
-      while (!odometryBuf.empty() &&
-             odometryBuf.front()->header.stamp.toSec() <
-                 cornerLastBuf.front()->header.stamp.toSec())
-        odometryBuf.pop();
-      if (odometryBuf.empty()) {
-        mBuf.unlock();
-        break;
-      }
+/// The messages of one frame, taken out of the buffers
+struct MappingInputs {
+  sensor_msgs::PointCloud2ConstPtr cornerLast, surfLast, fullRes;
+  nav_msgs::Odometry::ConstPtr odometry;
+};
+
+/// Moves the next frame into *in once its clouds and odometry are in, called
+/// under the lock of input_sync. Messages older than the oldest corner cloud
+/// are dropped on the way.
+bool TakeFrame(MappingInputs *in) {
+  if (cornerLastBuf.empty() || surfLastBuf.empty() || fullResBuf.empty() ||
+      odometryBuf.empty()) {
+    return false;
+  }
+  const double timeCorner = cornerLastBuf.front()->header.stamp.toSec();
+  while (!odometryBuf.empty() &&
+         odometryBuf.front()->header.stamp.toSec() < timeCorner)
+    odometryBuf.pop();
+  while (!surfLastBuf.empty() &&
+         surfLastBuf.front()->header.stamp.toSec() < timeCorner)
+    surfLastBuf.pop();
+  while (!fullResBuf.empty() &&
+         fullResBuf.front()->header.stamp.toSec() < timeCorner)
+    fullResBuf.pop();
+  if (odometryBuf.empty() || surfLastBuf.empty() || fullResBuf.empty()) {
+    return false;
+  }
 
-      while (!surfLastBuf.empty() &&
-             surfLastBuf.front()->header.stamp.toSec() <
-                 cornerLastBuf.front()->header.stamp.toSec())
-        surfLastBuf.pop();
-      if (surfLastBuf.empty()) {
-        mBuf.unlock();
-        break;
-      }
+  const double timeSurf = surfLastBuf.front()->header.stamp.toSec();
+  const double timeFull = fullResBuf.front()->header.stamp.toSec();
+  const double timeOdom = odometryBuf.front()->header.stamp.toSec();
+  if (timeCorner != timeOdom || timeSurf != timeOdom || timeFull != timeOdom) {
+    ROS_INFO("time corner %f surf %f full %f odom %f \n", timeCorner, timeSurf,
+             timeFull, timeOdom);
+    ROS_INFO("unsync messeage!");
+    return false;
+  }
 
-      while (!fullResBuf.empty() &&
-             fullResBuf.front()->header.stamp.toSec() <
-                 cornerLastBuf.front()->header.stamp.toSec())
-        fullResBuf.pop();
-      if (fullResBuf.empty()) {
-        mBuf.unlock();
-        break;
-      }
+  in->cornerLast = cornerLastBuf.front();
+  cornerLastBuf.pop();
+  in->surfLast = surfLastBuf.front();
+  surfLastBuf.pop();
+  in->fullRes = fullResBuf.front();
+  fullResBuf.pop();
+  in->odometry = odometryBuf.front();
+  odometryBuf.pop();
+  return true;
+}
 
-      timeLaserCloudCornerLast = cornerLastBuf.front()->header.stamp.toSec();
-      timeLaserCloudSurfLast = surfLastBuf.front()->header.stamp.toSec();
-      timeLaserCloudFullRes = fullResBuf.front()->header.stamp.toSec();
-      timeLaserOdometry = odometryBuf.front()->header.stamp.toSec();
-
-      if (timeLaserCloudCornerLast != timeLaserOdometry ||
-          timeLaserCloudSurfLast != timeLaserOdometry ||
-          timeLaserCloudFullRes != timeLaserOdometry) {
-        ROS_INFO("time corner %f surf %f full %f odom %f \n",
-               timeLaserCloudCornerLast, timeLaserCloudSurfLast,
-               timeLaserCloudFullRes, timeLaserOdometry);
-        ROS_INFO("unsync messeage!");
-        mBuf.unlock();
-        break;
-      }
+void process() {
+  while (ros::ok()) {
+    MappingInputs in;
+    if (input_sync.Wait([&] { return TakeFrame(&in); })) {
+      timeLaserCloudCornerLast = in.cornerLast->header.stamp.toSec();
+      timeLaserCloudSurfLast = in.surfLast->header.stamp.toSec();
+      timeLaserCloudFullRes = in.fullRes->header.stamp.toSec();
+      timeLaserOdometry = in.odometry->header.stamp.toSec();
 
       laserCloudCornerLast->clear();
-      pcl::fromROSMsg(*cornerLastBuf.front(), *laserCloudCornerLast);
-      cornerLastBuf.pop();
+      pcl::fromROSMsg(*in.cornerLast, *laserCloudCornerLast);
 
       laserCloudSurfLast->clear();
-      pcl::fromROSMsg(*surfLastBuf.front(), *laserCloudSurfLast);
-      surfLastBuf.pop();
+      pcl::fromROSMsg(*in.surfLast, *laserCloudSurfLast);
 
       laserCloudFullRes->clear();
-      pcl::fromROSMsg(*fullResBuf.front(), *laserCloudFullRes);
-      fullResBuf.pop();
-
-      q_wodom_curr.x() = odometryBuf.front()->pose.pose.orientation.x;
-      q_wodom_curr.y() = odometryBuf.front()->pose.pose.orientation.y;
-      q_wodom_curr.z() = odometryBuf.front()->pose.pose.orientation.z;
-      q_wodom_curr.w() = odometryBuf.front()->pose.pose.orientation.w;
-      t_wodom_curr.x() = odometryBuf.front()->pose.pose.position.x;
-      t_wodom_curr.y() = odometryBuf.front()->pose.pose.position.y;
-      t_wodom_curr.z() = odometryBuf.front()->pose.pose.position.z;
-      odometryBuf.pop();
+      pcl::fromROSMsg(*in.fullRes, *laserCloudFullRes);
 
-      //      while (!cornerLastBuf.empty()) {
-      //        //cornerLastBuf.pop();
-      //        printf("drop lidar frame in mapping for real time performance
-      //        \n");
-      //      }
-
-
-      mBuf.unlock();
+      q_wodom_curr.x() = in.odometry->pose.pose.orientation.x;
+      q_wodom_curr.y() = in.odometry->pose.pose.orientation.y;
+      q_wodom_curr.z() = in.odometry->pose.pose.orientation.z;
+      q_wodom_curr.w() = in.odometry->pose.pose.orientation.w;
+      t_wodom_curr.x() = in.odometry->pose.pose.position.x;
+      t_wodom_curr.y() = in.odometry->pose.pose.position.y;
+      t_wodom_curr.z() = in.odometry->pose.pose.position.z;
 
       TicToc t_whole;
 
@@ -1306,13 +1342,29 @@ void process() {
           }
 
           int surf_num = 0;
+          int normal_pruned = 0;
           for (int i = 0; i < laserCloudSurfStackNum; i++) {
             pointOri = laserCloudSurfStack->points[i];
             // double sqrtDis = pointOri.x * pointOri.x + pointOri.y *
             // pointOri.y + pointOri.z * pointOri.z;
+            if (USE_POINT_NORMALS) {
+              float planarity = Planarity(pointOri);
+              if (planarity > 0 && planarity < MIN_PLANARITY) {
+                normal_pruned++;
+                continue;
+              }
+            }
             pointAssociateToMap(&pointOri, &pointSel);
             kdtreeSurfFromMap->nearestKSearch(pointSel, 5, pointSearchInd,
                                               pointSearchSqDis);
+            if (USE_POINT_NORMALS &&
+                !NormalsAgree(
+                    NormalOf(pointSel),
+                    NormalOf(laserCloudSurfFromMap->points[pointSearchInd[0]]),
+                    MIN_NORMAL_COS)) {
+              normal_pruned++;
+              continue;
+            }
 
             Eigen::Matrix<double, 5, 3> matA0;
             Eigen::Matrix<double, 5, 1> matB0 =
@@ -1387,6 +1439,9 @@ void process() {
           // printf("surf num %d used surf num %d \n", laserCloudSurfStackNum,
           // surf_num);
 
+          if (USE_POINT_NORMALS) {
+            ROS_INFO("surf pruned by normals %d \n", normal_pruned);
+          }
           ROS_INFO("mapping data assosiation time %f ms \n", t_data.toc());
 
           TicToc t_solver;
@@ -1473,7 +1528,7 @@ void process() {
 
       TicToc t_pub;
       // publish surround map for every 5 frame
-      if (frameCount % 5 == 0) {
+      if (frameCount % 5 == 0 && HasSubscribers(pubLaserCloudSurround)) {
         laserCloudSurround->clear();
         for (int i = 0; i < laserCloudSurroundNum; i++) {
           int ind = laserCloudSurroundInd[i];
@@ -1489,7 +1544,7 @@ void process() {
         pubLaserCloudSurround.publish(laserCloudSurround3);
       }
 
-      if (frameCount % 20 == 0) {
+      if (frameCount % 20 == 0 && HasSubscribers(pubLaserCloudMap)) {
         pcl::PointCloud<PointType> laserCloudMap;
         for (int i = 0; i < 4851; i++) {
           laserCloudMap += *laserCloudCornerArray[i];
@@ -1502,12 +1557,15 @@ void process() {
         pubLaserCloudMap.publish(laserCloudMsg);
       }
 
-      laserCloudFullResColor->clear();
+      const bool b_pub_full_res = HasSubscribers(pubLaserCloudFullRes);
       int laserCloudFullResNum = laserCloudFullRes->points.size();
-      for (int i = 0; i < laserCloudFullResNum; i++) {
-        pcl::PointXYZRGB temp_point;
-        RGBpointAssociateToMap(&laserCloudFullRes->points[i], &temp_point);
-        laserCloudFullResColor->push_back(temp_point);
+      if (b_pub_full_res) {
+        laserCloudFullResColor->clear();
+        for (int i = 0; i < laserCloudFullResNum; i++) {
+          pcl::PointXYZRGB temp_point;
+          RGBpointAssociateToMap(&laserCloudFullRes->points[i], &temp_point);
+          laserCloudFullResColor->push_back(temp_point);
+        }
       }
 
 
@@ -1587,11 +1645,14 @@ void process() {
       
 
 
-      sensor_msgs::PointCloud2 laserCloudFullRes3;
-      pcl::toROSMsg(*laserCloudFullResColor, laserCloudFullRes3);
-      laserCloudFullRes3.header.stamp = ros::Time().fromSec(timeLaserOdometry);
-      laserCloudFullRes3.header.frame_id = "/camera_init";
-      pubLaserCloudFullRes.publish(laserCloudFullRes3);
+      if (b_pub_full_res) {
+        sensor_msgs::PointCloud2 laserCloudFullRes3;
+        pcl::toROSMsg(*laserCloudFullResColor, laserCloudFullRes3);
+        laserCloudFullRes3.header.stamp =
+            ros::Time().fromSec(timeLaserOdometry);
+        laserCloudFullRes3.header.frame_id = "/camera_init";
+        pubLaserCloudFullRes.publish(laserCloudFullRes3);
+      }
 
 
       // pcl::PCDWriter pcd_writer;
@@ -1608,6 +1669,12 @@ void process() {
       ROS_INFO("mapping pub time %f ms \n", t_pub.toc());
 
       ROS_INFO("whole mapping time %f ms +++++\n", t_whole.toc());
+      LogUnconsumedBytes();
+      if (HasSubscribers(pubMappingTime)) {
+        std_msgs::Float64 mappingTime;
+        mappingTime.data = t_whole.toc();
+        pubMappingTime.publish(mappingTime);
+      }
 
       nav_msgs::Odometry odomAftMapped;
       odomAftMapped.header.frame_id = "/camera_init";
@@ -1620,7 +1687,8 @@ void process() {
       odomAftMapped.pose.pose.position.x = t_w_curr.x();
       odomAftMapped.pose.pose.position.y = t_w_curr.y();
       odomAftMapped.pose.pose.position.z = t_w_curr.z();
-      pubOdomAftMapped.publish(odomAftMapped);
+      PublishTracked(pubOdomAftMapped, odomAftMapped);
+      stamp_latency.Add(odomAftMapped.header.stamp);
 
       geometry_msgs::PoseStamped laserAfterMappedPose;
       laserAfterMappedPose.header = odomAftMapped.header;
@@ -1628,7 +1696,9 @@ void process() {
       laserAfterMappedPath.header.stamp = odomAftMapped.header.stamp;
       laserAfterMappedPath.header.frame_id = "/camera_init";
       laserAfterMappedPath.poses.push_back(laserAfterMappedPose);
-      pubLaserAfterMappedPath.publish(laserAfterMappedPath);
+      if (HasSubscribers(pubLaserAfterMappedPath)) {
+        pubLaserAfterMappedPath.publish(laserAfterMappedPath);
+      }
 
       static tf::TransformBroadcaster br;
       tf::Transform transform;
@@ -1645,8 +1715,6 @@ void process() {
 
       frameCount++;
     }
-    std::chrono::milliseconds dura(2);
-    std::this_thread::sleep_for(dura);
   }
 }
 
@@ -1661,9 +1729,21 @@ int main(int argc, char **argv) {
   nh.param<float>("mapping_line_resolution", lineRes, 0.4);
   nh.param<float>("mapping_plane_resolution", planeRes, 0.8);
   nh.param<std::string>("pcd_save_path",pcd_save_path,"/home/admin/workspace/src/PCD/PCD.pcd");
+  nh.param<bool>("point_normals", USE_POINT_NORMALS, false);
+  nh.param<float>("min_planarity", MIN_PLANARITY, 0.2);
+  float max_normal_angle_deg;
+  nh.param<float>("max_normal_angle_deg", max_normal_angle_deg, 30);
+  MIN_NORMAL_COS = std::cos(max_normal_angle_deg * M_PI / 180);
   ROS_INFO("line resolution %f plane resolution %f \n", lineRes, planeRes);
   downSizeFilterCorner.setLeafSize(lineRes, lineRes, lineRes);
   downSizeFilterSurf.setLeafSize(planeRes, planeRes, planeRes);
+  /// Keep the first point of a voxel instead of the centroid
+  bool voxel_first_point;
+  nh.param<bool>("mapping_voxel_first_point", voxel_first_point, false);
+  if (voxel_first_point) {
+    downSizeFilterCorner.setPolicy(VoxelFilter::kFirstPoint);
+    downSizeFilterSurf.setPolicy(VoxelFilter::kFirstPoint);
+  }
 
   ros::Subscriber subCamera = nh.subscribe<sensor_msgs::Image>(
       "/image_topic", 100, cameraHandler);
@@ -1705,6 +1785,8 @@ int main(int argc, char **argv) {
   pubLaserAfterMappedPath =
       nh.advertise<nav_msgs::Path>("/aft_mapped_path", 100);
 
+  pubMappingTime = nh.advertise<std_msgs::Float64>("/laser_mapping_time", 100);
+
 
   nh.param<vector<double>>("mapping/extrinsic_T", extrinT, vector<double>());
   nh.param<vector<double>>("mapping/extrinsic_R", extrinR, vector<double>());
@@ -1736,6 +1818,8 @@ int main(int argc, char **argv) {
   std::thread mapping_process{process};
 
   ros::spin();
+  /// process() sees the shutdown within its wait, then the map is saved
+  mapping_process.join();
 
   // pcl::PCDWriter pcd_writer;
   // pcd_writer.writeBinary(pcd_save_path, *laserCloudWaitSave);
@@ -44,26 +44,41 @@
 #include <ros/ros.h>
 #include <sensor_msgs/Imu.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <std_msgs/Float64.h>
 #include <tf/transform_broadcaster.h>
 #include <tf/transform_datatypes.h>
+#include <algorithm>
 #include <cmath>
 #include <eigen3/Eigen/Dense>
 #include <mutex>
 #include <queue>
 
+#include "feature_extractor/normal_estimator.h"
 #include "lidarFactor.hpp"
+#include "loam_horizon/FeatureCloud.h"
 #include "loam_horizon/common.h"
+#include "loam_horizon/input_sync.h"
+#include "loam_horizon/lazy_publish.h"
 #include "loam_horizon/tic_toc.h"
 
 #define DISTORTION 0 // Low-speed scene, without distortion correction
 
 int corner_correspondence = 0, plane_correspondence = 0;
 
-constexpr double SCAN_PERIOD = 0.1;
+/// Time from one frame to the next, over which the pose increment is
+/// estimated; the intensity fraction of a point is its time since the frame
+/// start in s. livox_repub's frame_stride_ms, or frame_window_ms, when set.
+double SCAN_PERIOD = 0.1;
 constexpr double DISTANCE_SQ_THRESHOLD = 25;
 constexpr double NEARBY_SCAN = 2.5;
 
 int skipFrameNum = 5;
+
+/// Use the normals shipped by scanRegistration to drop weak surf points and
+/// surf correspondences across differently oriented surfaces
+bool USE_POINT_NORMALS = false;
+float MIN_PLANARITY = 0.2;
+float MIN_NORMAL_COS = 0.866;  // 30 deg
 bool systemInited = false;
 
 double timeCornerPointsSharp = 0;
@@ -112,14 +127,23 @@ std::queue<sensor_msgs::PointCloud2ConstPtr> cornerLessSharpBuf;
 std::queue<sensor_msgs::PointCloud2ConstPtr> surfFlatBuf;
 std::queue<sensor_msgs::PointCloud2ConstPtr> surfLessFlatBuf;
 std::queue<sensor_msgs::PointCloud2ConstPtr> fullPointsBuf;
-std::mutex mBuf;
+std::queue<loam_horizon::FeatureCloudConstPtr> featureBuf;
+InputSync input_sync;
+
+/// The messages of one frame, taken out of the buffers: the feature cloud,
+/// or the five clouds of the separate topics
+struct FrameInputs {
+  loam_horizon::FeatureCloudConstPtr featureCloud;
+  sensor_msgs::PointCloud2ConstPtr cornerSharp, cornerLessSharp, surfFlat,
+      surfLessFlat, fullRes;
+};
 
 // undistort lidar point
 void TransformToStart(PointType const *const pi, PointType *const po) {
   // interpolation ratio
   double s;
   if (DISTORTION)
-    s = (pi->intensity - int(pi->intensity))*10;
+    s = (pi->intensity - int(pi->intensity)) / SCAN_PERIOD;
   else
     s = 1.0;
   // s = 1;
@@ -155,38 +179,70 @@ void TransformToEnd(PointType const *const pi, PointType *const po) {
 
 void laserCloudSharpHandler(
     const sensor_msgs::PointCloud2ConstPtr &cornerPointsSharp2) {
-  mBuf.lock();
-  cornerSharpBuf.push(cornerPointsSharp2);
-  mBuf.unlock();
+  input_sync.Push([&] { cornerSharpBuf.push(cornerPointsSharp2); });
 }
 
 void laserCloudLessSharpHandler(
     const sensor_msgs::PointCloud2ConstPtr &cornerPointsLessSharp2) {
-  mBuf.lock();
-  cornerLessSharpBuf.push(cornerPointsLessSharp2);
-  mBuf.unlock();
+  input_sync.Push([&] { cornerLessSharpBuf.push(cornerPointsLessSharp2); });
 }
 
 void laserCloudFlatHandler(
     const sensor_msgs::PointCloud2ConstPtr &surfPointsFlat2) {
-  mBuf.lock();
-  surfFlatBuf.push(surfPointsFlat2);
-  mBuf.unlock();
+  input_sync.Push([&] { surfFlatBuf.push(surfPointsFlat2); });
 }
 
 void laserCloudLessFlatHandler(
     const sensor_msgs::PointCloud2ConstPtr &surfPointsLessFlat2) {
-  mBuf.lock();
-  surfLessFlatBuf.push(surfPointsLessFlat2);
-  mBuf.unlock();
+  input_sync.Push([&] { surfLessFlatBuf.push(surfPointsLessFlat2); });
 }
 
 // receive all point cloud
 void laserCloudFullResHandler(
     const sensor_msgs::PointCloud2ConstPtr &laserCloudFullRes2) {
-  mBuf.lock();
-  fullPointsBuf.push(laserCloudFullRes2);
-  mBuf.unlock();
+  input_sync.Push([&] { fullPointsBuf.push(laserCloudFullRes2); });
+}
+
+// receive the full cloud and its features in one message
+void laserFeatureCloudHandler(
+    const loam_horizon::FeatureCloudConstPtr &featureCloud) {
+  input_sync.Push([&] { featureBuf.push(featureCloud); });
+}
+
+/// Picks the points of indices out of cloud, bad indices are skipped
+void GatherPoints(const pcl::PointCloud<PointType> &cloud,
+                  const std::vector<uint32_t> &indices,
+                  pcl::PointCloud<PointType> *out) {
+  out->clear();
+  out->reserve(indices.size());
+  for (uint32_t ind : indices) {
+    if (ind < cloud.size()) out->push_back(cloud.points[ind]);
+  }
+}
+
+/// Moves the next frame into *in if all its messages are in, called under
+/// the lock of input_sync
+bool TakeFrame(FrameInputs *in) {
+  if (!featureBuf.empty()) {
+    in->featureCloud = featureBuf.front();
+    featureBuf.pop();
+    return true;
+  }
+  if (cornerSharpBuf.empty() || cornerLessSharpBuf.empty() ||
+      surfFlatBuf.empty() || surfLessFlatBuf.empty() || fullPointsBuf.empty()) {
+    return false;
+  }
+  in->cornerSharp = cornerSharpBuf.front();
+  cornerSharpBuf.pop();
+  in->cornerLessSharp = cornerLessSharpBuf.front();
+  cornerLessSharpBuf.pop();
+  in->surfFlat = surfFlatBuf.front();
+  surfFlatBuf.pop();
+  in->surfLessFlat = surfLessFlatBuf.front();
+  surfLessFlatBuf.pop();
+  in->fullRes = fullPointsBuf.front();
+  fullPointsBuf.pop();
+  return true;
 }
 
 int main(int argc, char **argv) {
@@ -194,25 +250,46 @@ int main(int argc, char **argv) {
   ros::NodeHandle nh;
 
   nh.param<int>("mapping_skip_frame", skipFrameNum, 2);
+  bool compact_features;
+  nh.param<bool>("compact_features", compact_features, false);
+  nh.param<bool>("point_normals", USE_POINT_NORMALS, false);
+  nh.param<float>("min_planarity", MIN_PLANARITY, 0.2);
+  float max_normal_angle_deg;
+  nh.param<float>("max_normal_angle_deg", max_normal_angle_deg, 30);
+  MIN_NORMAL_COS = std::cos(max_normal_angle_deg * M_PI / 180);
+  int frame_window_ms, frame_stride_ms;
+  nh.param<int>("frame_window_ms", frame_window_ms, 0);
+  nh.param<int>("frame_stride_ms", frame_stride_ms, 0);
+  frame_window_ms = std::min(frame_window_ms, 999);
+  if (frame_stride_ms <= 0 || frame_stride_ms > frame_window_ms) {
+    frame_stride_ms = frame_window_ms;
+  }
+  if (frame_stride_ms > 0) SCAN_PERIOD = frame_stride_ms / 1000.0;
 
   printf("Mapping %d Hz \n", 10 / skipFrameNum);
 
-  ros::Subscriber subCornerPointsSharp = nh.subscribe<sensor_msgs::PointCloud2>(
-      "/laser_cloud_sharp", 100, laserCloudSharpHandler);
+  ros::Subscriber subCornerPointsSharp, subCornerPointsLessSharp,
+      subSurfPointsFlat, subSurfPointsLessFlat, subLaserCloudFullRes,
+      subFeatureCloud;
+  if (compact_features) {
+    subFeatureCloud = nh.subscribe<loam_horizon::FeatureCloud>(
+        "/laser_feature_cloud", 100, laserFeatureCloudHandler);
+  } else {
+    subCornerPointsSharp = nh.subscribe<sensor_msgs::PointCloud2>(
+        "/laser_cloud_sharp", 100, laserCloudSharpHandler);
 
-  ros::Subscriber subCornerPointsLessSharp =
-      nh.subscribe<sensor_msgs::PointCloud2>("/laser_cloud_less_sharp", 100,
-                                             laserCloudLessSharpHandler);
+    subCornerPointsLessSharp = nh.subscribe<sensor_msgs::PointCloud2>(
+        "/laser_cloud_less_sharp", 100, laserCloudLessSharpHandler);
 
-  ros::Subscriber subSurfPointsFlat = nh.subscribe<sensor_msgs::PointCloud2>(
-      "/laser_cloud_flat", 100, laserCloudFlatHandler);
+    subSurfPointsFlat = nh.subscribe<sensor_msgs::PointCloud2>(
+        "/laser_cloud_flat", 100, laserCloudFlatHandler);
 
-  ros::Subscriber subSurfPointsLessFlat =
-      nh.subscribe<sensor_msgs::PointCloud2>("/laser_cloud_less_flat", 100,
-                                             laserCloudLessFlatHandler);
+    subSurfPointsLessFlat = nh.subscribe<sensor_msgs::PointCloud2>(
+        "/laser_cloud_less_flat", 100, laserCloudLessFlatHandler);
 
-  ros::Subscriber subLaserCloudFullRes = nh.subscribe<sensor_msgs::PointCloud2>(
-      "/velodyne_cloud_2", 100, laserCloudFullResHandler);
+    subLaserCloudFullRes = nh.subscribe<sensor_msgs::PointCloud2>(
+        "/velodyne_cloud_2", 100, laserCloudFullResHandler);
+  }
 
   ros::Publisher pubLaserCloudCornerLast =
       nh.advertise<sensor_msgs::PointCloud2>("/laser_cloud_corner_last", 100);
@@ -229,53 +306,72 @@ int main(int argc, char **argv) {
   ros::Publisher pubLaserPath =
       nh.advertise<nav_msgs::Path>("/laser_odom_path", 100);
 
+  /// Per-frame odometry time, feedback for the feature budget
+  ros::Publisher pubOdometryTime =
+      nh.advertise<std_msgs::Float64>("/laser_odometry_time", 100);
+
   nav_msgs::Path laserPath;
 
   int frameCount = 0;
-  ros::Rate rate(100);
+  /// The callbacks run on their own thread, each frame wakes the loop below
+  /// as soon as its last message is in
+  ros::AsyncSpinner spinner(1);
+  spinner.start();
 
   while (ros::ok()) {
-    ros::spinOnce();
-
-    if (!cornerSharpBuf.empty() && !cornerLessSharpBuf.empty() &&
-        !surfFlatBuf.empty() && !surfLessFlatBuf.empty() &&
-        !fullPointsBuf.empty()) {
-      timeCornerPointsSharp = cornerSharpBuf.front()->header.stamp.toSec();
-      timeCornerPointsLessSharp =
-          cornerLessSharpBuf.front()->header.stamp.toSec();
-      timeSurfPointsFlat = surfFlatBuf.front()->header.stamp.toSec();
-      timeSurfPointsLessFlat = surfLessFlatBuf.front()->header.stamp.toSec();
-      timeLaserCloudFullRes = fullPointsBuf.front()->header.stamp.toSec();
-
-      if (timeCornerPointsSharp != timeLaserCloudFullRes ||
-          timeCornerPointsLessSharp != timeLaserCloudFullRes ||
-          timeSurfPointsFlat != timeLaserCloudFullRes ||
-          timeSurfPointsLessFlat != timeLaserCloudFullRes) {
-        printf("unsync messeage!");
-        ROS_BREAK();
-      }
+    FrameInputs in;
+    if (input_sync.Wait([&] { return TakeFrame(&in); })) {
+      if (in.featureCloud) {
+        /// One message, one stamp: nothing to sync
+        const loam_horizon::FeatureCloudConstPtr &featureCloud =
+            in.featureCloud;
+
+        timeLaserCloudFullRes = featureCloud->header.stamp.toSec();
+        timeCornerPointsSharp = timeLaserCloudFullRes;
+        timeCornerPointsLessSharp = timeLaserCloudFullRes;
+        timeSurfPointsFlat = timeLaserCloudFullRes;
+        timeSurfPointsLessFlat = timeLaserCloudFullRes;
+
+        laserCloudFullRes->clear();
+        pcl::fromROSMsg(featureCloud->cloud, *laserCloudFullRes);
+        GatherPoints(*laserCloudFullRes, featureCloud->corner_sharp,
+                     cornerPointsSharp.get());
+        GatherPoints(*laserCloudFullRes, featureCloud->corner_less_sharp,
+                     cornerPointsLessSharp.get());
+        GatherPoints(*laserCloudFullRes, featureCloud->surf_flat,
+                     surfPointsFlat.get());
+        GatherPoints(*laserCloudFullRes, featureCloud->surf_less_flat,
+                     surfPointsLessFlat.get());
+      } else {
+        timeCornerPointsSharp = in.cornerSharp->header.stamp.toSec();
+        timeCornerPointsLessSharp = in.cornerLessSharp->header.stamp.toSec();
+        timeSurfPointsFlat = in.surfFlat->header.stamp.toSec();
+        timeSurfPointsLessFlat = in.surfLessFlat->header.stamp.toSec();
+        timeLaserCloudFullRes = in.fullRes->header.stamp.toSec();
+
+        if (timeCornerPointsSharp != timeLaserCloudFullRes ||
+            timeCornerPointsLessSharp != timeLaserCloudFullRes ||
+            timeSurfPointsFlat != timeLaserCloudFullRes ||
+            timeSurfPointsLessFlat != timeLaserCloudFullRes) {
+          printf("unsync messeage!");
+          ROS_BREAK();
+        }
 
-      mBuf.lock();
-      cornerPointsSharp->clear();
-      pcl::fromROSMsg(*cornerSharpBuf.front(), *cornerPointsSharp);
-      cornerSharpBuf.pop();
+        cornerPointsSharp->clear();
+        pcl::fromROSMsg(*in.cornerSharp, *cornerPointsSharp);
 
-      cornerPointsLessSharp->clear();
-      pcl::fromROSMsg(*cornerLessSharpBuf.front(), *cornerPointsLessSharp);
-      cornerLessSharpBuf.pop();
+        cornerPointsLessSharp->clear();
+        pcl::fromROSMsg(*in.cornerLessSharp, *cornerPointsLessSharp);
 
-      surfPointsFlat->clear();
-      pcl::fromROSMsg(*surfFlatBuf.front(), *surfPointsFlat);
-      surfFlatBuf.pop();
+        surfPointsFlat->clear();
+        pcl::fromROSMsg(*in.surfFlat, *surfPointsFlat);
 
-      surfPointsLessFlat->clear();
-      pcl::fromROSMsg(*surfLessFlatBuf.front(), *surfPointsLessFlat);
-      surfLessFlatBuf.pop();
+        surfPointsLessFlat->clear();
+        pcl::fromROSMsg(*in.surfLessFlat, *surfPointsLessFlat);
 
-      laserCloudFullRes->clear();
-      pcl::fromROSMsg(*fullPointsBuf.front(), *laserCloudFullRes);
-      fullPointsBuf.pop();
-      mBuf.unlock();
+        laserCloudFullRes->clear();
+        pcl::fromROSMsg(*in.fullRes, *laserCloudFullRes);
+      }
 
       TicToc t_whole;
       // initializing
@@ -349,7 +445,7 @@ int main(int argc, char **argv) {
 
                 double s;
                 if (DISTORTION)
-                  s = (cornerPointsSharp->points[i].intensity - int(cornerPointsSharp->points[i].intensity))*10;
+                  s = (cornerPointsSharp->points[i].intensity - int(cornerPointsSharp->points[i].intensity)) / SCAN_PERIOD;
                 else
                   s = 1.0;
 
@@ -364,10 +460,29 @@ int main(int argc, char **argv) {
           }
 
           // find correspondence for plane features
+          int normal_pruned = 0;
           for (int i = 0; i < surfPointsFlatNum; ++i) {
+            /// A point with a normal but a weak one is not on a plane
+            if (USE_POINT_NORMALS) {
+              float planarity = Planarity(surfPointsFlat->points[i]);
+              if (planarity > 0 && planarity < MIN_PLANARITY) {
+                normal_pruned++;
+                continue;
+              }
+            }
             TransformToStart(&(surfPointsFlat->points[i]), &pointSel);
             kdtreeSurfLast->nearestKSearch(pointSel, 5, pointSearchInd,
                                            pointSearchSqDis);
+            /// The closest point lies on another surface, skip the plane fit
+            if (USE_POINT_NORMALS &&
+                !NormalsAgree(
+                    q_last_curr.cast<float>() *
+                        NormalOf(surfPointsFlat->points[i]),
+                    NormalOf(laserCloudSurfLast->points[pointSearchInd[0]]),
+                    MIN_NORMAL_COS)) {
+              normal_pruned++;
+              continue;
+            }
 
             Eigen::Matrix<double, 5, 3> matA0;
             Eigen::Matrix<double, 5, 1> matB0 =
@@ -420,7 +535,7 @@ int main(int argc, char **argv) {
 
                 double s;
                 if (DISTORTION)
-                  s = (surfPointsFlat->points[i].intensity - int(surfPointsFlat->points[i].intensity))*10;
+                  s = (surfPointsFlat->points[i].intensity - int(surfPointsFlat->points[i].intensity)) / SCAN_PERIOD;
                 else
                   s = 1.0;
                 // printf(" Plane s------ %f  \n", s);
@@ -435,6 +550,9 @@ int main(int argc, char **argv) {
           }
           // printf("coner_correspondance %d, plane_correspondence %d \n",
           // corner_correspondence, plane_correspondence);
+          if (USE_POINT_NORMALS) {
+            printf("surf pruned by normals %d \n", normal_pruned);
+          }
           printf("data association time %f ms \n", t_data.toc());
 
           if ((corner_correspondence + plane_correspondence) < 10) {
@@ -473,7 +591,7 @@ int main(int argc, char **argv) {
       laserOdometry.pose.pose.position.x = t_w_curr.x();
       laserOdometry.pose.pose.position.y = t_w_curr.y();
       laserOdometry.pose.pose.position.z = t_w_curr.z();
-      pubLaserOdometry.publish(laserOdometry);
+      PublishTracked(pubLaserOdometry, laserOdometry);
 
       geometry_msgs::PoseStamped laserPose;
       laserPose.header = laserOdometry.header;
@@ -481,7 +599,7 @@ int main(int argc, char **argv) {
       laserPath.header.stamp = laserOdometry.header.stamp;
       laserPath.poses.push_back(laserPose);
       laserPath.header.frame_id = "/camera_init";
-      pubLaserPath.publish(laserPath);
+      if (HasSubscribers(pubLaserPath)) pubLaserPath.publish(laserPath);
 
       // transform corner features and plane features to the scan end point
       if (DISTORTION) {
@@ -529,29 +647,34 @@ int main(int argc, char **argv) {
         laserCloudCornerLast2.header.stamp =
             ros::Time().fromSec(timeSurfPointsLessFlat);
         laserCloudCornerLast2.header.frame_id = "/aft_mapped";
-        pubLaserCloudCornerLast.publish(laserCloudCornerLast2);
+        PublishTracked(pubLaserCloudCornerLast, laserCloudCornerLast2);
 
         sensor_msgs::PointCloud2 laserCloudSurfLast2;
         pcl::toROSMsg(*surfPointsFlat, laserCloudSurfLast2);
         laserCloudSurfLast2.header.stamp =
             ros::Time().fromSec(timeSurfPointsLessFlat);
         laserCloudSurfLast2.header.frame_id = "/aft_mapped";
-        pubLaserCloudSurfLast.publish(laserCloudSurfLast2);
+        PublishTracked(pubLaserCloudSurfLast, laserCloudSurfLast2);
 
         sensor_msgs::PointCloud2 laserCloudFullRes3;
         pcl::toROSMsg(*laserCloudFullRes, laserCloudFullRes3);
         laserCloudFullRes3.header.stamp =
             ros::Time().fromSec(timeSurfPointsLessFlat);
         laserCloudFullRes3.header.frame_id = "/aft_mapped";
-        pubLaserCloudFullRes.publish(laserCloudFullRes3);
+        PublishTracked(pubLaserCloudFullRes, laserCloudFullRes3);
       }
       printf("publication time %f ms \n", t_pub.toc());
       printf("whole laserOdometry time %f ms \n \n", t_whole.toc());
+      LogUnconsumedBytes();
+      if (HasSubscribers(pubOdometryTime)) {
+        std_msgs::Float64 odometryTime;
+        odometryTime.data = t_whole.toc();
+        pubOdometryTime.publish(odometryTime);
+      }
       if (t_whole.toc() > 100) ROS_WARN("odometry process over 100ms");
 
       frameCount++;
     }
-    rate.sleep();
   }
   return 0;
 }
@@ -1,53 +1,831 @@
-#include <pcl_conversions/pcl_conversions.h>
+#include <sensor_msgs/Imu.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
+#include <algorithm>
+#include <boost/bind/bind.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <eigen3/Eigen/Dense>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include "capture/livox_capture.h"
 #include "livox_ros_driver/CustomMsg.h"
+#include "nav_msgs/Odometry.h"
+#include "ros/callback_queue.h"
+#include "loam_horizon/IngestFilterCounts.h"
+#include "loam_horizon/IngestTelemetry.h"
+#include "loam_horizon/PointBudget.h"
 #include "loam_horizon/common.h"
+#include "loam_horizon/ingest_telemetry.h"
+#include "loam_horizon/lazy_publish.h"
+#include "loam_horizon/livox_point.h"
+#include "loam_horizon/point_budget.h"
 
-ros::Publisher pub_pcl_out0, pub_pcl_out1;
-uint64_t TO_MERGE_CNT = 1; 
+ros::Publisher pub_pcl_out0, pub_pcl_out1, pub_filter_counts, pub_point_budget;
+uint64_t TO_MERGE_CNT = 1;
 constexpr bool b_dbg_line = false;
-std::vector<livox_ros_driver::CustomMsgConstPtr> livox_data;
-void LivoxMsgCbk1(const livox_ros_driver::CustomMsgConstPtr& livox_msg_in) {
-  livox_data.push_back(livox_msg_in);
+
+/// A lidar packet as livox_repub reads it, a driver message or a packet of a
+/// mapped capture. Each field is read in place, from its first element and
+/// a byte stride: sizeof(CustomPoint) in a message, whose points are
+/// structs, the size of the field in a capture, whose fields are columns.
+struct PacketView {
+  uint64_t timebase = 0;
+  uint32_t point_num = 0;
+  ros::Time stamp;
+  const uint8_t *offset_time = nullptr, *x = nullptr, *y = nullptr,
+                *z = nullptr;
+  const uint8_t *reflectivity = nullptr, *tag = nullptr, *line = nullptr;
+  /// Strides of the 4 byte fields and of the 1 byte ones
+  size_t word_stride = 0, byte_stride = 0;
+  /// The message the fields point into, null for a capture, which stays
+  /// mapped while it is replayed
+  livox_ros_driver::CustomMsgConstPtr msg;
+  /// Per point, whether it goes into the frames, set by SelectPoints; empty
+  /// when every point does
+  std::vector<uint8_t> keep;
+
+  uint32_t OffsetTime(int i) const { return Word<uint32_t>(offset_time, i); }
+  float X(int i) const { return Word<float>(x, i); }
+  float Y(int i) const { return Word<float>(y, i); }
+  float Z(int i) const { return Word<float>(z, i); }
+  uint8_t Reflectivity(int i) const { return reflectivity[i * byte_stride]; }
+  uint8_t Tag(int i) const { return tag[i * byte_stride]; }
+  uint8_t Line(int i) const { return line[i * byte_stride]; }
+
+  template <typename T>
+  T Word(const uint8_t* first, int i) const {
+    T v;
+    std::memcpy(&v, first + i * word_stride, sizeof(T));
+    return v;
+  }
+};
+
+PacketView ViewOf(const livox_ros_driver::CustomMsgConstPtr& msg) {
+  PacketView view;
+  view.timebase = msg->timebase;
+  view.point_num = msg->point_num;
+  view.stamp = msg->header.stamp;
+  view.msg = msg;
+  if (msg->points.empty()) {
+    view.point_num = 0;
+    return view;
+  }
+  const livox_ros_driver::CustomPoint& p = msg->points[0];
+  auto bytes = [](const void* field) {
+    return reinterpret_cast<const uint8_t*>(field);
+  };
+  view.offset_time = bytes(&p.offset_time);
+  view.x = bytes(&p.x);
+  view.y = bytes(&p.y);
+  view.z = bytes(&p.z);
+  view.reflectivity = bytes(&p.reflectivity);
+  view.tag = bytes(&p.tag);
+  view.line = bytes(&p.line);
+  view.word_stride = view.byte_stride = sizeof(p);
+  return view;
+}
+
+PacketView ViewOf(const CapturePacket& packet) {
+  PacketView view;
+  view.timebase = packet.timebase;
+  view.point_num = packet.point_num;
+  view.stamp.fromNSec(packet.timebase);
+  auto bytes = [](const void* column) {
+    return reinterpret_cast<const uint8_t*>(column);
+  };
+  view.offset_time = bytes(packet.offset_time);
+  view.x = bytes(packet.x);
+  view.y = bytes(packet.y);
+  view.z = bytes(packet.z);
+  view.reflectivity = packet.reflectivity;
+  view.tag = packet.tag;
+  view.line = packet.line;
+  view.word_stride = 4;
+  view.byte_stride = 1;
+  return view;
+}
+
+std::vector<PacketView> livox_data;
+
+/// The merged frame, written in place: a LivoxPoint (20 bytes) a point, sized
+/// once per frame from the packets and reused, so its buffer stops growing
+/// once the largest frame has been seen
+sensor_msgs::PointCloud2 pcl_ros_msg;
+
+/// Filters of the driver points, tested in the frame of their lidar before
+/// they are copied into a frame, so dropped points are never serialized.
+/// Each one is off at its default.
+struct IngestFilter {
+  enum Reason { kTag, kReflectivity, kBlind, kBox, kFov, kNumReasons };
+
+  /// Points with any of these tag bits set are dropped. Livox tag bits 0-1
+  /// are the spatial noise confidence, 2-3 the intensity noise confidence,
+  /// 4-5 the return number.
+  uint8_t tag_mask = 0;
+  uint8_t min_reflectivity = 0;
+  float blind_sq = 0;
+  /// Points outside [box_min, box_max] are dropped
+  bool box = false;
+  float box_min[3], box_max[3];
+  /// Squared tangents of the half FOV, horizontal around +x and vertical,
+  /// 0 if off
+  float tan_h_sq = 0, tan_v_sq = 0;
+  bool enabled = false;
+
+  /// Points dropped by each filter and points kept, since the last report
+  uint64_t dropped[kNumReasons] = {};
+  uint64_t kept = 0;
+
+  /// The first filter dropping point i of packet, -1 if none
+  int Test(const PacketView& packet, int i) const {
+    if (packet.Tag(i) & tag_mask) return kTag;
+    if (packet.Reflectivity(i) < min_reflectivity) return kReflectivity;
+    const float x = packet.X(i), y = packet.Y(i), z = packet.Z(i);
+    const float xy_sq = x * x + y * y;
+    if (xy_sq + z * z < blind_sq) return kBlind;
+    if (box && (x < box_min[0] || x > box_max[0] || y < box_min[1] ||
+                y > box_max[1] || z < box_min[2] || z > box_max[2])) {
+      return kBox;
+    }
+    if (tan_h_sq > 0 && (x <= 0 || y * y > tan_h_sq * x * x)) return kFov;
+    if (tan_v_sq > 0 && z * z > tan_v_sq * xy_sq) return kFov;
+    return -1;
+  }
+
+  /// Whether point i of packet goes into the frame, counted either way
+  bool Keep(const PacketView& packet, int i) {
+    const int reason = Test(packet, i);
+    if (reason < 0) {
+      kept++;
+      return true;
+    }
+    dropped[reason]++;
+    return false;
+  }
+};
+IngestFilter ingest_filter;
+
+PointRateBudget point_budget;
+
+/// Frames of a fixed duration instead of TO_MERGE_CNT packets, 0 if off.
+/// Windows start on a grid from the first point, a frame holds the points
+/// timed in [start, start + window) and is stamped with start, the point
+/// times are relative to start. scanRegistration packs them into the
+/// fraction of the intensity, which needs the window to be shorter than 1 s.
+uint64_t FRAME_WINDOW_NS = 0;
+/// A window starts every stride, a stride shorter than the window gives
+/// overlapping frames at a higher rate with the density of a full window
+uint64_t FRAME_STRIDE_NS = 0;
+uint64_t window_start = 0;
+bool window_started = false;
+
+/// A lidar that sent nothing for this long behind the others no longer
+/// holds their frames back
+constexpr uint64_t kLidarTimeoutNs = 500000000;
+
+/// One input lidar of the time windows. Its points are moved into the
+/// frame of the first one by its extrinsic and its lines come after the
+/// lines of the lidars before it.
+struct LidarInput {
+  Eigen::Matrix3f rotation = Eigen::Matrix3f::Identity();
+  Eigen::Vector3f translation = Eigen::Vector3f::Zero();
+  bool identity = true;
+  int line_offset = 0;
+
+  /// Packets with points not published yet, oldest first. They are shared
+  /// with the driver or the capture, not copied, and by all the windows they
+  /// fall in.
+  std::deque<PacketView> packets;
+  /// Time of its newest point, 0 before the first packet
+  uint64_t newest = 0;
+
+  /// Its points of the window being published, in time order, a vector per
+  /// field so the extrinsic is applied a few points per instruction
+  std::vector<float> x, y, z;
+  std::vector<uint32_t> time;
+  std::vector<uint8_t> line, reflectivity;
+};
+std::vector<LidarInput> lidars(1);
+/// Columns of a lidar's staged points, as MergeWindow reads them
+struct MergeSource {
+  const float *x, *y, *z;
+  const uint32_t* time;
+  const uint8_t *line, *reflectivity;
+  int line_offset;
+};
+/// Columns of and merge position in each lidar's points, when there are
+/// more lidars than MergeWindow is specialized on
+std::vector<MergeSource> merge_sources;
+std::vector<size_t> head;
+
+/// Counters of the input for the telemetry, one LidarCounters per lidar
+IngestCounters ingest_counters;
+std::unique_ptr<LidarCounters[]> lidar_counters;
+
+/// Paces a capture replay on the consumption of its frames: a frame is
+/// published once laserMapping mapped one of the max_ahead frames before
+/// it, so no node behind livox_repub drops a frame and the frames of a run
+/// do not depend on how the nodes get scheduled. The replay then goes as
+/// fast as the slowest node.
+struct ConsumerPacing {
+  bool enabled = false;
+  /// Frames published and not mapped yet, at most this many. laserOdometry
+  /// hands laserMapping one frame in mapping_skip_frame, so it is more.
+  size_t max_ahead = 4;
+  /// Stamps of the frames published and not mapped yet, oldest first
+  std::deque<uint64_t> pending;
+  /// Stamp of the newest mapped frame
+  uint64_t mapped = 0;
+  /// Frames sent after a second with no frame mapped
+  uint64_t timeouts = 0;
+  /// The mapped frames come in on a queue of their own, only read while
+  /// waiting in Wait()
+  ros::CallbackQueue queue;
+  ros::Subscriber sub;
+
+  void Mapped(const nav_msgs::OdometryConstPtr& odom) {
+    mapped = std::max<uint64_t>(mapped, odom->header.stamp.toNSec());
+  }
+
+  /// Blocks until a frame can be published
+  void Wait() {
+    const ros::WallTime timeout = ros::WallTime::now() + ros::WallDuration(1);
+    while (ros::ok()) {
+      /// laserMapping stamps its output in seconds, a microsecond of slack
+      /// covers the rounding
+      while (!pending.empty() && pending.front() <= mapped + 1000) {
+        pending.pop_front();
+      }
+      if (pending.size() < max_ahead) return;
+      if (ros::WallTime::now() > timeout) {
+        timeouts++;
+        ROS_WARN_THROTTLE(10, "capture replay: no frame mapped for 1 s, "
+                              "%lu frames sent unpaced",
+                          (unsigned long)timeouts);
+        pending.clear();
+        return;
+      }
+      queue.callAvailable(ros::WallDuration(0.01));
+    }
+  }
+};
+ConsumerPacing consumer_pacing;
+
+/// Sizes the output message for num_points, returns its first point
+LivoxPoint* ResizeFrame(size_t num_points) {
+  if (pcl_ros_msg.fields.empty()) SetLivoxFields(&pcl_ros_msg);
+  sensor_msgs::PointCloud2Modifier modifier(pcl_ros_msg);
+  modifier.resize(num_points);
+  pcl_ros_msg.is_dense = true;
+  return reinterpret_cast<LivoxPoint*>(pcl_ros_msg.data.data());
+}
+
+void PublishFrame(uint64_t stamp_ns) {
+  pcl_ros_msg.header.stamp.fromNSec(stamp_ns);
+  pcl_ros_msg.header.frame_id = "/livox";
+  if (consumer_pacing.enabled) {
+    consumer_pacing.Wait();
+    consumer_pacing.pending.push_back(stamp_ns);
+  }
+  PublishTracked(pub_pcl_out1, pcl_ros_msg);
+  LogUnconsumedBytes();
+  ingest_counters.Frame(pcl_ros_msg.width);
+
+  if (HasSubscribers(pub_filter_counts)) {
+    loam_horizon::IngestFilterCounts counts;
+    counts.header = pcl_ros_msg.header;
+    counts.kept = ingest_filter.kept;
+    counts.tag = ingest_filter.dropped[IngestFilter::kTag];
+    counts.reflectivity = ingest_filter.dropped[IngestFilter::kReflectivity];
+    counts.blind = ingest_filter.dropped[IngestFilter::kBlind];
+    counts.box = ingest_filter.dropped[IngestFilter::kBox];
+    counts.fov = ingest_filter.dropped[IngestFilter::kFov];
+    pub_filter_counts.publish(counts);
+  }
+  ingest_filter.kept = 0;
+  std::fill_n(ingest_filter.dropped, IngestFilter::kNumReasons, 0);
+
+  if (point_budget.points_per_second > 0) {
+    loam_horizon::PointBudget budget;
+    budget.header = pcl_ros_msg.header;
+    budget.ratio = point_budget.ratio;
+    budget.offered_rate = point_budget.offered_rate;
+    budget.budget = point_budget.points_per_second;
+    budget.offered = point_budget.offered;
+    budget.kept = point_budget.kept;
+    point_budget.Update(stamp_ns);
+    PublishTracked(pub_point_budget, budget);
+  }
+}
+
+inline uint64_t PointTime(const PacketView& packet, int i) {
+  return packet.timebase + packet.OffsetTime(i);
+}
+
+/// Points [*begin, *end) of packet are the ones timed in [start, stop). The
+/// driver sends the points of a packet in time order.
+void PointRange(const PacketView& packet, uint64_t start, uint64_t stop,
+                int* begin, int* end) {
+  /// Offsets relative to the packet, clamped to its uint32 range
+  auto offset = [&](uint64_t t) -> uint64_t {
+    return t <= packet.timebase ? 0 : t - packet.timebase;
+  };
+  /// Binary search for the first point at or after off
+  auto first_at = [&](uint64_t off) {
+    int first = 0, count = packet.point_num;
+    while (count > 0) {
+      const int half = count / 2;
+      if (packet.OffsetTime(first + half) < off) {
+        first += half + 1;
+        count -= half + 1;
+      } else {
+        count = half;
+      }
+    }
+    return first;
+  };
+  *begin = first_at(offset(start));
+  *end = first_at(offset(stop));
+}
+
+/// Copies the points of lidar timed in [start, stop) that pass the ingest
+/// filter into its staging buffers and moves them into the common frame.
+/// Returns their number.
+size_t GatherWindow(LidarInput* lidar, uint64_t start, uint64_t stop) {
+  size_t n = 0;
+  for (const auto& packet : lidar->packets) {
+    int begin, end;
+    PointRange(packet, start, stop, &begin, &end);
+    n += end - begin;
+  }
+  lidar->x.resize(n);
+  lidar->y.resize(n);
+  lidar->z.resize(n);
+  /// A sentinel after the last one, the merge needs no end test
+  lidar->time.resize(n + 1);
+  lidar->time[n] = std::numeric_limits<uint32_t>::max();
+  lidar->line.resize(n);
+  lidar->reflectivity.resize(n);
+
+  size_t k = 0;
+  for (const auto& packet : lidar->packets) {
+    int begin, end;
+    PointRange(packet, start, stop, &begin, &end);
+    for (int i = begin; i < end; ++i) {
+      if (!packet.keep.empty() && !packet.keep[i]) continue;
+      const uint8_t line = packet.Line(i);
+      lidar->x[k] = packet.X(i);
+      lidar->y[k] = packet.Y(i);
+      lidar->z[k] = packet.Z(i);
+      lidar->time[k] = PointTime(packet, i) - start;
+      lidar->line[k] = line;
+      lidar->reflectivity[k] = packet.Reflectivity(i);
+      ++k;
+    }
+  }
+  if (k < n) {
+    n = k;
+    lidar->x.resize(n);
+    lidar->y.resize(n);
+    lidar->z.resize(n);
+    lidar->time.resize(n + 1);
+    lidar->time[n] = std::numeric_limits<uint32_t>::max();
+    lidar->line.resize(n);
+    lidar->reflectivity.resize(n);
+  }
+
+  if (!lidar->identity) {
+    const Eigen::Matrix3f& r = lidar->rotation;
+    const Eigen::Vector3f& t = lidar->translation;
+    float* __restrict__ x = lidar->x.data();
+    float* __restrict__ y = lidar->y.data();
+    float* __restrict__ z = lidar->z.data();
+    for (size_t k = 0; k < n; ++k) {
+      const float px = x[k], py = y[k], pz = z[k];
+      x[k] = r(0, 0) * px + r(0, 1) * py + r(0, 2) * pz + t(0);
+      y[k] = r(1, 0) * px + r(1, 1) * py + r(1, 2) * pz + t(1);
+      z[k] = r(2, 0) * px + r(2, 1) * py + r(2, 2) * pz + t(2);
+    }
+  }
+  return n;
+}
+
+/// Writes the staged points of all lidars into the frame at out, merged in
+/// time order. kLidars is their number, 0 for any; known, the pick unrolls
+/// and the merge positions stay in registers.
+template <int kLidars>
+void MergeWindow(size_t num_points, LivoxPoint* out) {
+  const int num_lidars = kLidars ? kLidars : lidars.size();
+  MergeSource local_source[kLidars ? kLidars : 1];
+  size_t local_head[kLidars ? kLidars : 1] = {};
+  merge_sources.resize(kLidars ? 0 : num_lidars);
+  head.assign(kLidars ? 0 : num_lidars, 0);
+  MergeSource* src = kLidars ? local_source : merge_sources.data();
+  size_t* pos = kLidars ? local_head : head.data();
+  for (int c = 0; c < num_lidars; c++) {
+    const LidarInput& lidar = lidars[c];
+    src[c] = {lidar.x.data(),    lidar.y.data(),
+              lidar.z.data(),    lidar.time.data(),
+              lidar.line.data(), lidar.reflectivity.data(),
+              lidar.line_offset};
+  }
+
+  /// k-way merge, k being a handful of lidars a linear pick is the cheapest.
+  /// Finished lidars show the sentinel, so the pick compiles to conditional
+  /// moves instead of branches on the interleaved times. The lidars take
+  /// turns point by point, so the pick is not skipped for runs; what it
+  /// costs is the chain from one pick to the next, kept to a compare and a
+  /// move per lidar: the raw pointers cannot alias the frame as the vectors
+  /// can, and the positions advance by a known index, not pos[l].
+  for (size_t n = 0; n < num_points; ++n, ++out) {
+    int l = 0;
+    size_t k = pos[0];
+    uint32_t best = src[0].time[k];
+    for (int c = 1; c < num_lidars; c++) {
+      const uint32_t t = src[c].time[pos[c]];
+      const bool earlier = t < best;
+      l = earlier ? c : l;
+      k = earlier ? pos[c] : k;
+      best = earlier ? t : best;
+    }
+    if (kLidars) {
+      for (int c = 0; c < kLidars; c++) pos[c] += c == l;
+    } else {
+      pos[l]++;
+    }
+    const MergeSource& s = src[l];
+    out->x = s.x[k];
+    out->y = s.y[k];
+    out->z = s.z[k];
+    out->t_offset = best * 1e-9;
+    out->line = s.line_offset + s.line[k];
+    out->reflectivity = s.reflectivity[k];
+  }
+}
+
+/// Publishes the points of all lidars timed in [start, stop), merged in
+/// time order
+void PublishWindow(uint64_t start, uint64_t stop) {
+  size_t num_points = 0;
+  for (auto& lidar : lidars) num_points += GatherWindow(&lidar, start, stop);
+  if (num_points == 0) return;
+
+  LivoxPoint* out = ResizeFrame(num_points);
+  switch (lidars.size()) {
+    case 1: MergeWindow<1>(num_points, out); break;
+    case 2: MergeWindow<2>(num_points, out); break;
+    case 3: MergeWindow<3>(num_points, out); break;
+    default: MergeWindow<0>(num_points, out); break;
+  }
+  PublishFrame(start);
+}
+
+/// Whether every lidar still sending has points at or after stop, so the
+/// window ending there has all its points
+bool WindowComplete(uint64_t stop) {
+  uint64_t newest = 0;
+  for (const auto& lidar : lidars) newest = std::max(newest, lidar.newest);
+  if (newest < stop) return false;
+  for (const auto& lidar : lidars) {
+    if (lidar.newest < stop && lidar.newest + kLidarTimeoutNs >= newest) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Publishes every window the packet completes. A window is complete once
+/// each lidar sent a point at or after its end, the packets of a lidar come
+/// in time order.
+void AggregateByTime(LidarInput* lidar, PacketView packet) {
+  if (packet.point_num == 0) return;
+  const uint64_t first = PointTime(packet, 0);
+  const uint64_t last = PointTime(packet, packet.point_num - 1);
+
+  if (window_started && last + FRAME_WINDOW_NS <= lidar->newest) {
+    /// Its time went back, e.g. a bag started over
+    ROS_WARN("livox_repub: time jumped back, restarting the frame windows");
+    for (auto& l : lidars) {
+      l.packets.clear();
+      l.newest = 0;
+    }
+    window_started = false;
+  }
+  /// Late, no window left needs its points
+  if (window_started && last < window_start) return;
+  if (!window_started) {
+    window_start = first;
+    window_started = true;
+  }
+  lidar->packets.push_back(std::move(packet));
+  lidar->newest = std::max(lidar->newest, last);
+
+  while (WindowComplete(window_start + FRAME_WINDOW_NS)) {
+    PublishWindow(window_start, window_start + FRAME_WINDOW_NS);
+    window_start += FRAME_STRIDE_NS;
+
+    /// Forget the packets no window needs any more, and step over a gap in
+    /// the data rather than through empty windows
+    uint64_t next = std::numeric_limits<uint64_t>::max();
+    for (auto& l : lidars) {
+      while (!l.packets.empty() &&
+             PointTime(l.packets.front(), l.packets.front().point_num - 1) <
+                 window_start) {
+        l.packets.pop_front();
+      }
+      if (l.packets.empty()) continue;
+      int begin, end;
+      PointRange(l.packets.front(), window_start,
+                 std::numeric_limits<uint64_t>::max(), &begin, &end);
+      next = std::min(next, PointTime(l.packets.front(), begin));
+    }
+    window_start += (next - window_start) / FRAME_STRIDE_NS * FRAME_STRIDE_NS;
+  }
+}
+
+/// Merges every TO_MERGE_CNT packets into a frame
+void AggregateByCount(PacketView livox_msg_in) {
+  livox_data.push_back(std::move(livox_msg_in));
   if (livox_data.size() < TO_MERGE_CNT) return;
 
-  pcl::PointCloud<PointType> pcl_in;
+  size_t num_points = 0;
+  for (const auto& livox_msg : livox_data) {
+    num_points += livox_msg.point_num;
+  }
 
+  LivoxPoint* out = ResizeFrame(num_points);
+  size_t kept = 0;
   for (size_t j = 0; j < livox_data.size(); j++) {
-    auto& livox_msg = livox_data[j];
-    auto time_end = livox_msg->points.back().offset_time;
-    for (unsigned int i = 0; i < livox_msg->point_num; ++i) {
-      PointType pt;
-      pt.x = livox_msg->points[i].x;
-      pt.y = livox_msg->points[i].y;
-      pt.z = livox_msg->points[i].z;
-//      if (pt.z < -0.3) continue; // delete some outliers (our Horizon's assembly height is 0.3 meters)
-      float s = livox_msg->points[i].offset_time / (float)time_end;
-//       ROS_INFO("_s-------- %.6f ",s);
-      pt.intensity = livox_msg->points[i].line + s*0.1; // The integer part is line number and the decimal part is timestamp
-//      ROS_INFO("intensity-------- %.6f ",pt.intensity);
-      pt.curvature = livox_msg->points[i].reflectivity * 0.1;
-      // ROS_INFO("pt.curvature-------- %.3f ",pt.curvature);
-      pcl_in.push_back(pt);
+    const PacketView& livox_msg = livox_data[j];
+    if (livox_msg.point_num == 0) continue;
+    auto time_end = livox_msg.OffsetTime(livox_msg.point_num - 1);
+    for (unsigned int i = 0; i < livox_msg.point_num; ++i) {
+      if (!livox_msg.keep.empty() && !livox_msg.keep[i]) continue;
+      const uint8_t line = livox_msg.Line(i);
+      out->x = livox_msg.X(i);
+      out->y = livox_msg.Y(i);
+      out->z = livox_msg.Z(i);
+      float s = livox_msg.OffsetTime(i) / (float)time_end;
+      out->t_offset = s * 0.1;  // Spread over a 0.1 s frame
+      out->line = line;
+      out->reflectivity = livox_msg.Reflectivity(i);
+      ++out;
+      ++kept;
     }
   }
+  if (kept < num_points) ResizeFrame(kept);
 
   /// timebase 5ms ~ 50000000, so 10 ~ 1ns
 
-  unsigned long timebase_ns = livox_data[0]->timebase;
-  ros::Time timestamp;
-  timestamp.fromNSec(timebase_ns);
+  unsigned long timebase_ns = livox_data[0].timebase;
+  PublishFrame(timebase_ns);
+  livox_data.clear();
+}
+
+/// Counts a packet of lidar coming in, returns the time it did
+std::chrono::steady_clock::time_point TelemetryIn(int lidar,
+                                                  const PacketView& packet) {
+  LidarCounters& t = lidar_counters[lidar];
+  t.Packet(packet.timebase, packet.point_num);
+  const ros::Time now = ros::Time::now();
+  if (now > packet.stamp) {
+    AtomicMax(t.stamp_age_max_us, (now - packet.stamp).toNSec() / 1000);
+  }
+  return std::chrono::steady_clock::now();
+}
+
+/// Counts the end of the callback of a packet that came in at in
+void TelemetryOut(std::chrono::steady_clock::time_point in) {
+  const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - in);
+  size_t queue_depth = livox_data.size();
+  for (const auto& lidar : lidars) queue_depth += lidar.packets.size();
+  ingest_counters.Callback(us.count(), queue_depth);
+}
 
-  //   ROS_INFO("livox1 republish %u points at time %f buf size %ld",
-  //   pcl_in.size(),
-  //           timestamp.toSec(), livox_data.size());
+/// Runs the ingest filter and the point budget over the points of a packet
+/// of lidar as it comes in, once, whatever number of frames they fall in
+void SelectPoints(const LidarInput& lidar, PacketView* packet) {
+  const bool budget = point_budget.points_per_second > 0;
+  if (!ingest_filter.enabled) ingest_filter.kept += packet->point_num;
+  if (!ingest_filter.enabled && !budget) return;
+  packet->keep.resize(packet->point_num);
+  for (uint32_t i = 0; i < packet->point_num; ++i) {
+    bool keep = !ingest_filter.enabled || ingest_filter.Keep(*packet, i);
+    if (keep && budget) {
+      keep = point_budget.Keep(lidar.line_offset + packet->Line(i));
+    }
+    packet->keep[i] = keep;
+  }
+}
 
-  sensor_msgs::PointCloud2 pcl_ros_msg;
-  pcl::toROSMsg(pcl_in, pcl_ros_msg);
-  pcl_ros_msg.header.stamp.fromNSec(timebase_ns);
-  pcl_ros_msg.header.frame_id = "/livox";
-  pub_pcl_out1.publish(pcl_ros_msg);
+/// Frames a packet of lidar, from the driver or a capture. Several lidars
+/// always have time windows.
+void IngestPacket(int lidar, PacketView packet) {
+  const auto in = TelemetryIn(lidar, packet);
+  SelectPoints(lidars[lidar], &packet);
+  if (FRAME_WINDOW_NS > 0) {
+    AggregateByTime(&lidars[lidar], std::move(packet));
+  } else {
+    AggregateByCount(std::move(packet));
+  }
+  TelemetryOut(in);
+}
+
+void LivoxMsgCbk(const livox_ros_driver::CustomMsgConstPtr& livox_msg_in,
+                 int lidar) {
+  IngestPacket(lidar, ViewOf(livox_msg_in));
+}
+
+/// Totals of a report, for the log line
+struct TelemetrySummary {
+  uint64_t packets = 0, frames = 0, queue_depth_max = 0;
+  double gap_max_ms = 0, jitter_ms = 0, frame_points_mean = 0,
+         callback_max_ms = 0;
+};
+
+/// Takes the counters of the last period_s seconds and resets them. Their
+/// totals go into *summary, the full report into *msg unless it is null.
+void TakeTelemetry(double period_s, TelemetrySummary* summary,
+                   loam_horizon::IngestTelemetry* msg) {
+  *summary = TelemetrySummary();
+  if (msg) {
+    msg->period_s = period_s;
+    msg->lidars.resize(lidars.size());
+  }
+  for (size_t l = 0; l < lidars.size(); l++) {
+    LidarCounters& t = lidar_counters[l];
+    uint64_t histogram[LidarCounters::kGapBuckets];
+    uint64_t gaps = 0;
+    for (int b = 0; b < LidarCounters::kGapBuckets; b++) {
+      histogram[b] = AtomicTake(t.gap_histogram[b]);
+      gaps += histogram[b];
+    }
+    const uint64_t packets = AtomicTake(t.packets);
+    const uint64_t points = AtomicTake(t.points);
+    const double sum = AtomicTake(t.gap_sum_us);
+    const double sq_sum = AtomicTake(t.gap_sq_sum_us);
+    const double mean = gaps ? sum / gaps : 0;
+    const double gap_max_ms = AtomicTake(t.gap_max_us) * 1e-3;
+    const double jitter_ms =
+        gaps ? std::sqrt(std::max(sq_sum / gaps - mean * mean, 0.0)) * 1e-3
+             : 0;
+    const uint64_t time_backs = AtomicTake(t.time_backs);
+    const double stamp_age_max_ms = AtomicTake(t.stamp_age_max_us) * 1e-3;
+
+    summary->packets += packets;
+    summary->gap_max_ms = std::max(summary->gap_max_ms, gap_max_ms);
+    summary->jitter_ms = std::max(summary->jitter_ms, jitter_ms);
+    if (!msg) continue;
+    loam_horizon::LidarTelemetry& out = msg->lidars[l];
+    out.packets = packets;
+    out.points = points;
+    out.gap_histogram.assign(histogram, histogram + LidarCounters::kGapBuckets);
+    out.gap_mean_ms = mean * 1e-3;
+    out.gap_max_ms = gap_max_ms;
+    out.jitter_ms = jitter_ms;
+    out.time_backs = time_backs;
+    out.stamp_age_max_ms = stamp_age_max_ms;
+  }
+
+  const uint64_t frames = AtomicTake(ingest_counters.frames);
+  const uint64_t frame_points = AtomicTake(ingest_counters.frame_points_sum);
+  const uint64_t frame_points_min = AtomicTake(
+      ingest_counters.frame_points_min, std::numeric_limits<uint64_t>::max());
+  const uint64_t frame_points_max =
+      AtomicTake(ingest_counters.frame_points_max);
+  const uint64_t callbacks = AtomicTake(ingest_counters.callbacks);
+  const double callback_us = AtomicTake(ingest_counters.callback_sum_us);
+  summary->frames = frames;
+  summary->frame_points_mean = frames ? (double)frame_points / frames : 0;
+  summary->callback_max_ms =
+      AtomicTake(ingest_counters.callback_max_us) * 1e-3;
+  summary->queue_depth_max = AtomicTake(ingest_counters.queue_depth_max);
+  if (!msg) return;
+  msg->frames = frames;
+  msg->frame_points_min = frames ? frame_points_min : 0;
+  msg->frame_points_max = frame_points_max;
+  msg->frame_points_mean = summary->frame_points_mean;
+  msg->callback_mean_ms = callbacks ? callback_us / callbacks * 1e-3 : 0;
+  msg->callback_max_ms = summary->callback_max_ms;
+  msg->queue_depth_max = summary->queue_depth_max;
+}
+
+/// Publishes the telemetry once a second until shutdown. It only reads and
+/// resets the counters, the callbacks never wait on it. The message is only
+/// built for a subscriber, the counters are reset either way.
+void TelemetryLoop(ros::Publisher pub) {
+  auto last = std::chrono::steady_clock::now();
+  while (ros::ok()) {
+    ros::WallDuration(1).sleep();
+    const auto now = std::chrono::steady_clock::now();
+    const double period_s = std::chrono::duration<double>(now - last).count();
+    last = now;
+    TelemetrySummary summary;
+    if (HasSubscribers(pub)) {
+      loam_horizon::IngestTelemetry msg;
+      msg.header.stamp = ros::Time::now();
+      msg.header.frame_id = "/livox";
+      TakeTelemetry(period_s, &summary, &msg);
+      pub.publish(msg);
+    } else {
+      TakeTelemetry(period_s, &summary, nullptr);
+    }
+
+    ROS_INFO_THROTTLE(10,
+                      "ingest: %lu packets, gap max %.1f ms, jitter %.2f ms, "
+                      "%lu frames of %.0f points, callback max %.2f ms, "
+                      "queue max %lu",
+                      (unsigned long)summary.packets, summary.gap_max_ms,
+                      summary.jitter_ms, (unsigned long)summary.frames,
+                      summary.frame_points_mean, summary.callback_max_ms,
+                      (unsigned long)summary.queue_depth_max);
+  }
+}
+
+/// Feeds the packets of a capture, read in place, to the framing in place
+/// of the driver topics, and publishes its IMU samples on /imu. rate 1
+/// replays in real time; below 0 a frame waits for laserMapping to keep up,
+/// see ConsumerPacing; 0 is as fast as livox_repub goes, nodes behind it
+/// drop the frames their queues cannot hold.
+void ReplayCapture(const std::string& path, double rate,
+                   const ros::Publisher& pub_imu) {
+  CaptureReader reader;
+  if (!reader.Open(path)) {
+    ROS_ERROR("livox_repub: %s", reader.error().c_str());
+    return;
+  }
+  if (reader.recovered()) {
+    ROS_WARN("capture %s was not closed, %zu records recovered", path.c_str(),
+             reader.size());
+  }
+  if (reader.size() == 0) return;
+
+  /// Frames sent before anyone listens would be lost
+  const ros::WallTime wait_end = ros::WallTime::now() + ros::WallDuration(5);
+  while (ros::ok() &&
+         (pub_pcl_out1.getNumSubscribers() == 0 ||
+          (consumer_pacing.enabled &&
+           consumer_pacing.sub.getNumPublishers() == 0)) &&
+         ros::WallTime::now() < wait_end) {
+    ros::WallDuration(0.01).sleep();
+  }
+
+  const ros::WallTime wall_start = ros::WallTime::now();
+  /// Pace from here, moved on a jump of the stamps of more than a second
+  ros::WallTime pace_wall = wall_start;
+  uint64_t pace_stamp = reader.entry(0).stamp_ns;
+  size_t num_packets = 0, num_imu = 0;
+  CapturePacket packet;
+  CaptureImuSample sample;
+  for (size_t i = 0; i < reader.size() && ros::ok(); i++) {
+    const CaptureIndexEntry& entry = reader.entry(i);
+    if (rate > 0) {
+      const ros::WallTime now = ros::WallTime::now();
+      const double ahead =
+          ((int64_t)(entry.stamp_ns - pace_stamp) * 1e-9) / rate -
+          (now - pace_wall).toSec();
+      if (ahead > 1 || ahead < -1) {
+        pace_wall = now;
+        pace_stamp = entry.stamp_ns;
+      } else if (ahead > 0) {
+        ros::WallDuration(ahead).sleep();
+      }
+    }
+
+    if (reader.Packet(i, &packet)) {
+      if (packet.lidar >= lidars.size()) continue;
+      IngestPacket(packet.lidar, ViewOf(packet));
+      num_packets++;
+    } else if (reader.Imu(i, &sample)) {
+      sensor_msgs::Imu imu;
+      imu.header.stamp.fromNSec(entry.stamp_ns);
+      imu.header.frame_id = "/livox";
+      imu.angular_velocity.x = sample.angular_velocity[0];
+      imu.angular_velocity.y = sample.angular_velocity[1];
+      imu.angular_velocity.z = sample.angular_velocity[2];
+      imu.linear_acceleration.x = sample.linear_acceleration[0];
+      imu.linear_acceleration.y = sample.linear_acceleration[1];
+      imu.linear_acceleration.z = sample.linear_acceleration[2];
+      pub_imu.publish(imu);
+      num_imu++;
+    }
+  }
+  ROS_INFO("capture replayed: %zu packets, %zu imu in %.2f s", num_packets,
+           num_imu, (ros::WallTime::now() - wall_start).toSec());
+  if (consumer_pacing.timeouts > 0) {
+    ROS_WARN("capture replay: %lu frames sent without waiting for mapping",
+             (unsigned long)consumer_pacing.timeouts);
+  }
+  /// The packets held for the next frame point into the capture, which is
+  /// unmapped on return
   livox_data.clear();
+  for (auto& lidar : lidars) lidar.packets.clear();
 }
 
 int main(int argc, char** argv) {
@@ -56,9 +834,148 @@ int main(int argc, char** argv) {
 
   ROS_INFO("start livox_repub");
 
-  ros::Subscriber sub_livox_msg1 = nh.subscribe<livox_ros_driver::CustomMsg>(
-      "/livox/lidar", 100, LivoxMsgCbk1);
+  int frame_window_ms;
+  nh.param<int>("frame_window_ms", frame_window_ms, 0);
+  if (frame_window_ms >= 1000) {
+    ROS_WARN("frame_window_ms %d is not below 1000, using 999",
+             frame_window_ms);
+    frame_window_ms = 999;
+  }
+  FRAME_WINDOW_NS = std::max(frame_window_ms, 0) * 1000000ull;
+  int frame_stride_ms;
+  nh.param<int>("frame_stride_ms", frame_stride_ms, 0);
+  if (frame_stride_ms <= 0 || frame_stride_ms > frame_window_ms) {
+    frame_stride_ms = frame_window_ms;
+  }
+  FRAME_STRIDE_NS = std::max(frame_stride_ms, 0) * 1000000ull;
+
+  /// Ingest filter, see IngestFilter
+  int filter_tag_mask, filter_min_reflectivity;
+  double filter_blind;
+  std::vector<double> filter_box, filter_fov_deg;
+  nh.param<int>("filter_tag_mask", filter_tag_mask, 0);
+  nh.param<int>("filter_min_reflectivity", filter_min_reflectivity, 0);
+  nh.param<double>("filter_blind", filter_blind, 0);
+  nh.param<std::vector<double>>("filter_box", filter_box, {});
+  nh.param<std::vector<double>>("filter_fov_deg", filter_fov_deg, {});
+  IngestFilter& filter = ingest_filter;
+  filter.tag_mask = filter_tag_mask & 0xff;
+  filter.min_reflectivity =
+      std::min(std::max(filter_min_reflectivity, 0), 255);
+  filter.blind_sq = filter_blind > 0 ? filter_blind * filter_blind : 0;
+  if (filter_box.size() == 6) {
+    filter.box = true;
+    for (int a = 0; a < 3; a++) {
+      filter.box_min[a] = filter_box[a];
+      filter.box_max[a] = filter_box[a + 3];
+    }
+  } else if (!filter_box.empty()) {
+    ROS_WARN("filter_box needs min x y z max x y z, ignored");
+  }
+  /// Full angles, a half angle must stay below 90 degrees
+  auto tan_half_sq = [](double deg) {
+    if (deg <= 0 || deg >= 180) return 0.0;
+    const double t = std::tan(deg2rad(deg / 2));
+    return t * t;
+  };
+  if (filter_fov_deg.size() >= 1) {
+    filter.tan_h_sq = tan_half_sq(filter_fov_deg[0]);
+  }
+  if (filter_fov_deg.size() >= 2) {
+    filter.tan_v_sq = tan_half_sq(filter_fov_deg[1]);
+  }
+  filter.enabled = filter.tag_mask || filter.min_reflectivity ||
+                   filter.blind_sq > 0 || filter.box || filter.tan_h_sq > 0 ||
+                   filter.tan_v_sq > 0;
+
+  int point_budget_pps;
+  nh.param<int>("point_budget", point_budget_pps, 0);
+  point_budget.points_per_second = std::max(point_budget_pps, 0);
+
+  /// More lidars: their topics, and per lidar x y z (m) roll pitch yaw (deg)
+  /// into the frame of the first one
+  std::vector<std::string> lidar_topics;
+  std::vector<double> lidar_extrinsics;
+  int lidar_lines;
+  nh.param<std::vector<std::string>>("lidar_topics", lidar_topics,
+                                     {"/livox/lidar"});
+  nh.param<std::vector<double>>("lidar_extrinsics", lidar_extrinsics, {});
+  nh.param<int>("lidar_lines", lidar_lines, 6);
+  if (lidar_topics.empty()) lidar_topics.push_back("/livox/lidar");
+  if (lidar_lines < 1 || lidar_topics.size() * lidar_lines >
+                             (size_t)PointRateBudget::kMaxLines) {
+    ROS_ERROR("%zu lidars of %d lines do not fit the %d lines of a frame",
+              lidar_topics.size(), lidar_lines, PointRateBudget::kMaxLines);
+    return 1;
+  }
+  lidars.resize(lidar_topics.size());
+  for (size_t l = 0; l < lidars.size(); l++) {
+    LidarInput& lidar = lidars[l];
+    lidar.line_offset = l * lidar_lines;
+    if (lidar_extrinsics.size() < 6 * (l + 1)) continue;
+    const double* e = &lidar_extrinsics[6 * l];
+    lidar.translation = Eigen::Vector3f(e[0], e[1], e[2]);
+    lidar.rotation =
+        (Eigen::AngleAxisd(deg2rad(e[5]), Eigen::Vector3d::UnitZ()) *
+         Eigen::AngleAxisd(deg2rad(e[4]), Eigen::Vector3d::UnitY()) *
+         Eigen::AngleAxisd(deg2rad(e[3]), Eigen::Vector3d::UnitX()))
+            .toRotationMatrix()
+            .cast<float>();
+    lidar.identity = lidar.rotation.isIdentity() && lidar.translation.isZero();
+  }
+  /// Points of several lidars only merge by time
+  if (lidars.size() > 1 && FRAME_WINDOW_NS == 0) {
+    ROS_WARN("%zu lidars need frame_window_ms, using 100 ms", lidars.size());
+    FRAME_WINDOW_NS = FRAME_STRIDE_NS = 100000000;
+  }
+  ROS_INFO("%zu lidars, %d lines each, scan_line should be %zu",
+           lidars.size(), lidar_lines, lidars.size() * lidar_lines);
+
   pub_pcl_out1 = nh.advertise<sensor_msgs::PointCloud2>("/livox_pcl0", 100);
+  pub_filter_counts = nh.advertise<loam_horizon::IngestFilterCounts>(
+      "/livox_repub/filter_counts", 100);
+  pub_point_budget = nh.advertise<loam_horizon::PointBudget>(
+      "/livox_repub/point_budget", 100);
+  ros::Publisher pub_telemetry = nh.advertise<loam_horizon::IngestTelemetry>(
+      "/livox_repub/telemetry", 10);
+  lidar_counters.reset(new LidarCounters[lidars.size()]);
+  std::thread telemetry_thread(TelemetryLoop, pub_telemetry);
+
+  /// A capture instead of the driver, see livox_capture_convert
+  std::string capture_file;
+  double capture_rate;
+  nh.param<std::string>("capture_file", capture_file, "");
+  nh.param<double>("capture_rate", capture_rate, -1);
+  if (!capture_file.empty()) {
+    if (capture_rate < 0) {
+      int capture_ahead, mapping_skip_frame;
+      nh.param<int>("capture_ahead", capture_ahead, 4);
+      nh.param<int>("mapping_skip_frame", mapping_skip_frame, 2);
+      consumer_pacing.enabled = true;
+      consumer_pacing.max_ahead =
+          std::max(std::max(capture_ahead, mapping_skip_frame + 1), 1);
+      ros::SubscribeOptions ops =
+          ros::SubscribeOptions::create<nav_msgs::Odometry>(
+              "/aft_mapped_to_init", 100,
+              boost::bind(&ConsumerPacing::Mapped, &consumer_pacing,
+                          boost::placeholders::_1),
+              ros::VoidPtr(), &consumer_pacing.queue);
+      consumer_pacing.sub = nh.subscribe(ops);
+    }
+    ros::Publisher pub_imu = nh.advertise<sensor_msgs::Imu>("/imu", 1000);
+    ReplayCapture(capture_file, capture_rate, pub_imu);
+    ros::spin();
+    telemetry_thread.join();
+    return 0;
+  }
+
+  std::vector<ros::Subscriber> sub_livox_msg(lidars.size());
+  for (size_t l = 0; l < lidars.size(); l++) {
+    sub_livox_msg[l] = nh.subscribe<livox_ros_driver::CustomMsg>(
+        lidar_topics[l], 100,
+        boost::bind(&LivoxMsgCbk, boost::placeholders::_1, (int)l));
+  }
 
   ros::spin();
+  telemetry_thread.join();
 }
@@ -35,7 +35,6 @@
 
 #include <nav_msgs/Odometry.h>
 #include <opencv2/opencv.hpp>
-#include <pcl/filters/voxel_grid.h>
 #include <pcl/kdtree/kdtree_flann.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -43,24 +42,34 @@
 #include <ros/ros.h>
 #include <sensor_msgs/Imu.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
+#include <std_msgs/Float64.h>
 #include <tf/transform_datatypes.h>
-#include <visualization_msgs/MarkerArray.h>
+#include <algorithm>
 #include <cmath>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "feature_extractor/curvature_kernel.h"
+#include "feature_extractor/feature_budget.h"
+#include "feature_extractor/feature_extractor.h"
+#include "feature_extractor/ground_segmenter.h"
+#include "feature_extractor/normal_estimator.h"
+#include "feature_extractor/range_image.h"
+#include "feature_extractor/scan_ingest.h"
+#include "livox_ros_driver/CustomMsg.h"
+#include "loam_horizon/FeatureCloud.h"
+#include "loam_horizon/FeatureQuota.h"
 #include "loam_horizon/common.h"
+#include "loam_horizon/lazy_publish.h"
+#include "loam_horizon/livox_point.h"
 #include "loam_horizon/tic_toc.h"
 
 using std::atan2;
 using std::cos;
 using std::sin;
 
-constexpr bool dbg_show_id = false;
-constexpr bool b_only_1_scan = false;
-constexpr bool b_viz_curv = false;
-
-constexpr bool b_normalize_curv = true;
 
 const double scanPeriod = 0.1;
 
@@ -69,12 +78,31 @@ int systemInitCount = 0;
 bool systemInited = false;
 int N_SCANS = 0;
 
-float cloudCurvature[400000];
-int cloudSortInd[400000];
-int cloudNeighborPicked[400000];
-int cloudLabel[400000];
+/// Feature extraction of the current frame, its workspace is reused
+FeatureExtractor extractor;
+FeatureSet features;
+
+/// Adapts the feature quotas to the pipeline latency, null when disabled
+std::unique_ptr<FeatureBudgetController> budget;
+FeatureBudgetConfig budget_config;
+
+/// The current frame grouped by scan line, reused across frames
+PointCloudXYZI::Ptr laserCloud(new PointCloudXYZI());
+std::vector<int> line_size;
 
-bool comp(int i, int j) { return (cloudCurvature[i] < cloudCurvature[j]); }
+/// Azimuth / elevation index of laserCloud, for neighbors across lines
+RangeImage range_image;
+bool BUILD_RANGE_IMAGE = false;
+
+/// Caps the ground points among the flat features, null when disabled.
+/// Flat features dropped so far, each one a plane residual less in mapping.
+std::unique_ptr<GroundSegmenter> ground_segmenter;
+uint64_t ground_flat_dropped = 0;
+uint64_t ground_flat_total = 0;
+
+/// Normals and planarity of the surface features, shipped in normal_x/y/z
+NormalEstimator normal_estimator;
+bool POINT_NORMALS = false;
 
 ros::Publisher pubLaserCloud;
 ros::Publisher pubCornerPointsSharp;
@@ -82,632 +110,368 @@ ros::Publisher pubCornerPointsLessSharp;
 ros::Publisher pubSurfPointsFlat;
 ros::Publisher pubSurfPointsLessFlat;
 ros::Publisher pubRemovePoints;
+ros::Publisher pubFeatureCloud;
+ros::Publisher pubFeatureQuota;
 std::vector<ros::Publisher> pubEachScan;
 
 ros::Publisher pub_curvature;
 
 bool PUB_EACH_LINE = true;
+/// Publish one FeatureCloud instead of the full cloud and four feature clouds
+bool COMPACT_FEATURES = false;
 
 double MINIMUM_RANGE = 0.1;
 double THRESHOLD_FLAT = 0.01;
 double THRESHOLD_SHARP = 0.01;
 
-template <typename PointT>
-void removeClosedPointCloud(const pcl::PointCloud<PointT> &cloud_in,
-                            pcl::PointCloud<PointT> &cloud_out, float thres) {
-  if (&cloud_in != &cloud_out) {
-    cloud_out.header = cloud_in.header;
-    cloud_out.points.resize(cloud_in.points.size());
+/// Reads the LivoxPoints straight from the message buffer and groups them by
+/// scan line into *cloud, see ScanIngest
+ScanIngest scan_ingest;
+void IngestScan(const sensor_msgs::PointCloud2 &msg, float thres,
+                PointCloudXYZI *cloud, std::vector<int> *line_size) {
+  const LivoxPoint *points = LivoxPoints(msg);
+  if (!points) {
+    ROS_WARN_THROTTLE(10, "cloud without the livox_repub fields, dropped");
   }
+  const int num_points = points ? msg.width * msg.height : 0;
+  scan_ingest.Ingest(points, num_points, N_SCANS, thres, cloud, line_size,
+                     BUILD_RANGE_IMAGE ? &range_image : nullptr);
+}
 
-  size_t j = 0;
-
-  for (size_t i = 0; i < cloud_in.points.size(); ++i) {
-    if (cloud_in.points[i].x * cloud_in.points[i].x +
-            cloud_in.points[i].y * cloud_in.points[i].y +
-            cloud_in.points[i].z * cloud_in.points[i].z <
-        thres * thres)
-      continue;
-    cloud_out.points[j] = cloud_in.points[i];
-    j++;
-  }
-  if (j != cloud_in.points.size()) {
-    cloud_out.points.resize(j);
+/// Debug cloud with the curvature and label of every point, RViz can color
+/// it by either field. Points the kernel skips (5 at each end) get label 99.
+/// label: -1: flat, 0: less-flat, 1:less-edge, 2:edge, 99: un-reliable
+sensor_msgs::PointCloud2 curv_msg;
+void VisualizeCurvature(const float *v_curv, const int *v_label,
+                        const PointCloudXYZI &pcl_in,
+                        const std_msgs::Header &hdr) {
+  const int pt_num = pcl_in.size();
+  curv_msg.header = hdr;
+  sensor_msgs::PointCloud2Modifier modifier(curv_msg);
+  modifier.setPointCloud2Fields(
+      5, "x", 1, sensor_msgs::PointField::FLOAT32, "y", 1,
+      sensor_msgs::PointField::FLOAT32, "z", 1,
+      sensor_msgs::PointField::FLOAT32, "curvature", 1,
+      sensor_msgs::PointField::FLOAT32, "label", 1,
+      sensor_msgs::PointField::INT8);
+  modifier.resize(pt_num);
+
+  sensor_msgs::PointCloud2Iterator<float> it_x(curv_msg, "x");
+  sensor_msgs::PointCloud2Iterator<float> it_curv(curv_msg, "curvature");
+  sensor_msgs::PointCloud2Iterator<int8_t> it_label(curv_msg, "label");
+  for (int i = 0; i < pt_num; ++i, ++it_x, ++it_curv, ++it_label) {
+    const auto &pt = pcl_in[i];
+    it_x[0] = pt.x;
+    it_x[1] = pt.y;
+    it_x[2] = pt.z;
+    bool computed = i >= kCurvatureMargin && i < pt_num - kCurvatureMargin;
+    *it_curv = computed ? v_curv[i] : 0;
+    *it_label = computed ? v_label[i] : kLabelUnreliable;
   }
 
-  cloud_out.height = 1;
-  cloud_out.width = static_cast<uint32_t>(j);
-  cloud_out.is_dense = true;
+  pub_curvature.publish(curv_msg);
 }
 
-template <typename PointT>
-void VisualizeCurvature(float *v_curv, int *v_label,
-                        const pcl::PointCloud<PointT> &pcl_in,
-                        const std_msgs::Header &hdr) {
-  ROS_ASSERT(pcl_in.size() < 400000);
-
-  /// Same marker attributes
-  visualization_msgs::Marker txt_mk;
-  txt_mk.header = hdr;
-  txt_mk.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
-  txt_mk.ns = "default";
-  txt_mk.id = 0;
-  txt_mk.action = visualization_msgs::Marker::ADD;
-  txt_mk.pose.orientation.x = 0;
-  txt_mk.pose.orientation.y = 0;
-  txt_mk.pose.orientation.z = 0;
-  txt_mk.pose.orientation.w = 1;
-  txt_mk.scale.z = 0.05;
-  txt_mk.color.a = 1;
-  txt_mk.color.r = 0;
-  txt_mk.color.g = 1;
-  txt_mk.color.b = 0;
-
-  static visualization_msgs::MarkerArray curv_txt_msg;
-  // for (size_t i = 0; i < curv_txt_msg.markers.size(); ++i) {
-  //   auto &mk_i = curv_txt_msg.markers[i];
-  //   mk_i = txt_mk;
-  //   mk_i.header.stamp = txt_mk.header.stamp - ros::Duration(0.001);
-  //   mk_i.action = visualization_msgs::Marker::DELETE;
-  //   mk_i.text = "";
-  //   mk_i.ns = "old";
-  //   mk_i.color.a = 0;
-  // }
-  // pub_curvature.publish(curv_txt_msg);
-  // ros::Rate r(200);
-  // r.sleep();
-
-  /// Marger array message
-  static size_t pre_pt_num = 0;
-  size_t pt_num = pcl_in.size();
-
-  if (pre_pt_num == 0) {
-    curv_txt_msg.markers.reserve(400000);
+/// Copies the normals of cloud[indices] into the feature cloud they were
+/// picked into, the two are in the same order
+void CopyNormals(const PointCloudXYZI &cloud,
+                 const std::vector<uint32_t> &indices,
+                 PointCloudXYZI *features) {
+  if (indices.size() != features->size()) return;
+  for (size_t i = 0; i < indices.size(); i++) {
+    const PointType &src = cloud.points[indices[i]];
+    PointType &dst = features->points[i];
+    dst.normal_x = src.normal_x;
+    dst.normal_y = src.normal_y;
+    dst.normal_z = src.normal_z;
   }
-  if (pre_pt_num > pt_num) {
-    curv_txt_msg.markers.resize(pre_pt_num);
-  } else {
-    curv_txt_msg.markers.resize(pt_num);
+}
+
+/// Normals, debug clouds, publishing and the feature budget of the frame in
+/// laserCloud / features
+void PublishFrame(const std_msgs::Header &header, TicToc *t_whole) {
+  if (ground_segmenter) {
+    TicToc t_ground;
+    const int num_flat = features.surf_flat_ind.size();
+    int dropped = ground_segmenter->CapGroundFlat(laserCloud->points.data(),
+                                                  range_image, &features);
+    ground_flat_total += ground_segmenter->num_ground_flat();
+    ground_flat_dropped += dropped;
+    printf("ground time %f, ground flat %d of %d, dropped %d \n",
+           t_ground.toc(), ground_segmenter->num_ground_flat(), num_flat,
+           dropped);
+    ROS_INFO_THROTTLE(10, "ground flat features %lu, dropped %lu",
+                      ground_flat_total, ground_flat_dropped);
   }
 
-  int edge_num = 0, edgeless_num = 0, flat_num = 0, flatless_num = 0, nn = 0;
+  if (POINT_NORMALS) {
+    TicToc t_normal;
+    /// Less-flat points include the flat ones
+    const std::vector<uint32_t> &normal_ind = features.surf_less_flat_ind;
+    int num_normals = normal_estimator.Estimate(
+        laserCloud->points.data(), line_size, range_image, normal_ind);
+    CopyNormals(*laserCloud, features.surf_flat_ind, &features.surf_flat);
+    CopyNormals(*laserCloud, features.surf_less_flat_ind,
+                &features.surf_less_flat);
+    printf("normal time %f, %d of %lu surf points \n", t_normal.toc(),
+           num_normals, normal_ind.size());
+  }
 
-  /// Add marker and namespace
-  for (size_t i = 0; i < pcl_in.size(); ++i) {
-    auto curv = v_curv[i];
-    auto label = v_label[i];  /// -1: flat, 0: less-flat, 1:less-edge, 2:edge
-    const auto &pt = pcl_in[i];
+  /// The budget counts the extraction, not the debug clouds and publishing
+  const double extraction_ms = t_whole->toc();
 
-    switch (label) {
-      case 2: {
-        /// edge
-        auto &mk_i = curv_txt_msg.markers[i];
-        mk_i = txt_mk;
-        mk_i.ns = "edge";
-        mk_i.id = i;
-        mk_i.pose.position.x = pt.x;
-        mk_i.pose.position.y = pt.y;
-        mk_i.pose.position.z = pt.z;
-        mk_i.color.a = 1;
-        mk_i.color.r = 1;
-        mk_i.color.g = 0;
-        mk_i.color.b = 0;
-        char cstr[10];
-        snprintf(cstr, 9, "%.2f", curv);
-        mk_i.text = std::string(cstr);
-        /// debug
-        if (dbg_show_id) {
-          mk_i.text = std::to_string(i);
-        }
-
-        edge_num++;
-        break;
-      }
-      case 1: {
-        /// less edge
-        auto &mk_i = curv_txt_msg.markers[i];
-        mk_i = txt_mk;
-        mk_i.ns = "edgeless";
-        mk_i.id = i;
-        mk_i.pose.position.x = pt.x;
-        mk_i.pose.position.y = pt.y;
-        mk_i.pose.position.z = pt.z;
-        mk_i.color.a = 0.5;
-        mk_i.color.r = 0.5;
-        mk_i.color.g = 0;
-        mk_i.color.b = 0.8;
-        char cstr[10];
-        snprintf(cstr, 9, "%.2f", curv);
-        mk_i.text = std::string(cstr);
-        /// debug
-        if (dbg_show_id) {
-          mk_i.text = std::to_string(i);
-        }
-
-        edgeless_num++;
-        break;
-      }
-      case 0: {
-        /// less flat
-        auto &mk_i = curv_txt_msg.markers[i];
-        mk_i = txt_mk;
-        mk_i.ns = "flatless";
-        mk_i.id = i;
-        mk_i.pose.position.x = pt.x;
-        mk_i.pose.position.y = pt.y;
-        mk_i.pose.position.z = pt.z;
-        mk_i.color.a = 0.5;
-        mk_i.color.r = 0;
-        mk_i.color.g = 0.5;
-        mk_i.color.b = 0.8;
-        char cstr[10];
-        snprintf(cstr, 9, "%.2f", curv);
-        mk_i.text = std::string(cstr);
-        /// debug
-        if (dbg_show_id) {
-          mk_i.text = std::to_string(i);
-        }
-
-        flatless_num++;
-        break;
-      }
-      case -1: {
-        /// flat
-        auto &mk_i = curv_txt_msg.markers[i];
-        mk_i = txt_mk;
-        mk_i.ns = "flat";
-        mk_i.id = i;
-        mk_i.pose.position.x = pt.x;
-        mk_i.pose.position.y = pt.y;
-        mk_i.pose.position.z = pt.z;
-        mk_i.color.a = 1;
-        mk_i.color.r = 0;
-        mk_i.color.g = 1;
-        mk_i.color.b = 0;
-        char cstr[10];
-        snprintf(cstr, 9, "%.2f", curv);
-        mk_i.text = std::string(cstr);
-        /// debug
-        if (dbg_show_id) {
-          mk_i.text = std::to_string(i);
-        }
-
-        flat_num++;
-        break;
-      }
-      default: {
-        /// Un-reliable
-        /// Do nothing for label=99
-        // ROS_ASSERT_MSG(false, "%d", label);
-        auto &mk_i = curv_txt_msg.markers[i];
-        mk_i = txt_mk;
-        mk_i.ns = "unreliable";
-        mk_i.id = i;
-        mk_i.pose.position.x = pt.x;
-        mk_i.pose.position.y = pt.y;
-        mk_i.pose.position.z = pt.z;
-        mk_i.color.a = 0;
-        mk_i.color.r = 0;
-        mk_i.color.g = 0;
-        mk_i.color.b = 0;
-        char cstr[10];
-        snprintf(cstr, 9, "%.2f", curv);
-        mk_i.text = std::string(cstr);
-
-        nn++;
-        break;
-      }
-    }
-  }
-  ROS_INFO("edge/edgeless/flatless/flat/nn num: [%d / %d / %d / %d / %d] - %lu",
-           edge_num, edgeless_num, flatless_num, flat_num, nn, pt_num);
-
-  /// Delete old points
-  if (pre_pt_num > pt_num) {
-    ROS_WARN("%lu > %lu", pre_pt_num, pt_num);
-    // curv_txt_msg.markers.resize(pre_pt_num);
-    for (size_t i = pt_num; i < pre_pt_num; ++i) {
-      auto &mk_i = curv_txt_msg.markers[i];
-      mk_i.action = visualization_msgs::Marker::DELETE;
-      mk_i.color.a = 0;
-      mk_i.color.r = 0;
-      mk_i.color.g = 0;
-      mk_i.color.b = 0;
-      mk_i.ns = "old";
-      mk_i.text = "";
-    }
+  /// Visualize curvature
+  if (HasSubscribers(pub_curvature)) {
+    std_msgs::Header ros_hdr = header;
+    ros_hdr.frame_id = "/aft_mapped";
+    VisualizeCurvature(extractor.curvature().data(),
+                       extractor.label().data(), *laserCloud, ros_hdr);
   }
-  pre_pt_num = pt_num;
 
-  pub_curvature.publish(curv_txt_msg);
-}
+  /// The full cloud is serialized once, the compact message carries it as is
+  loam_horizon::FeatureCloud featureMsg;
+  sensor_msgs::PointCloud2 &laserCloudOutMsg = featureMsg.cloud;
+  pcl::toROSMsg(*laserCloud, laserCloudOutMsg);
+  laserCloudOutMsg.header.stamp = header.stamp;
+  laserCloudOutMsg.header.frame_id = "/aft_mapped";
 
-void laserCloudHandler(const sensor_msgs::PointCloud2ConstPtr &laserCloudMsg) {
-  if (!systemInited) {
-    systemInitCount++;
-    if (systemInitCount >= systemDelay) {
-      systemInited = true;
-    } else
-      return;
+  if (COMPACT_FEATURES) {
+    featureMsg.header = laserCloudOutMsg.header;
+    featureMsg.corner_sharp = features.corner_sharp_ind;
+    featureMsg.corner_less_sharp = features.corner_less_sharp_ind;
+    featureMsg.surf_flat = features.surf_flat_ind;
+    featureMsg.surf_less_flat = features.surf_less_flat_ind;
+    PublishTracked(pubFeatureCloud, featureMsg);
   }
 
-  TicToc t_whole;
-  TicToc t_prepare;
-  std::vector<int> scanStartInd(N_SCANS, 0);
-  std::vector<int> scanEndInd(N_SCANS, 0);
-
-  pcl::PointCloud<PointType> laserCloudIn;
-  pcl::fromROSMsg(*laserCloudMsg, laserCloudIn);
-  std::vector<int> indices;
-
-  pcl::removeNaNFromPointCloud(laserCloudIn, laserCloudIn, indices);
-  removeClosedPointCloud(laserCloudIn, laserCloudIn, MINIMUM_RANGE);
-
-  int cloudSize = laserCloudIn.points.size();
-  int count = cloudSize;
-  PointType point;
-  std::vector<pcl::PointCloud<PointType>> laserCloudScans(N_SCANS);
-  for (int i = 0; i < cloudSize; i++) {
-    point.x = laserCloudIn.points[i].x;
-    point.y = laserCloudIn.points[i].y;
-    point.z = laserCloudIn.points[i].z;
-    point.intensity = laserCloudIn.points[i].intensity;
-    point.curvature = laserCloudIn.points[i].curvature;
-    int scanID = 0;
-    if (N_SCANS == 6) {
-      scanID = (int)point.intensity;
-    }
-    laserCloudScans[scanID].push_back(point);
+  /// laserOdometry reads the per-class topics unless it gets the compact
+  /// message, other consumers such as rviz still get them on subscribing
+  auto legacy = [](const ros::Publisher &pub) {
+    return !COMPACT_FEATURES || HasSubscribers(pub);
+  };
+  if (legacy(pubLaserCloud)) PublishTracked(pubLaserCloud, laserCloudOutMsg);
+
+  if (legacy(pubCornerPointsSharp)) {
+    sensor_msgs::PointCloud2 cornerPointsSharpMsg;
+    pcl::toROSMsg(features.corner_sharp, cornerPointsSharpMsg);
+    cornerPointsSharpMsg.header.stamp = header.stamp;
+    cornerPointsSharpMsg.header.frame_id = "/aft_mapped";
+    PublishTracked(pubCornerPointsSharp, cornerPointsSharpMsg);
   }
 
-  cloudSize = count;
-  printf("points size %d \n", cloudSize);
+  if (legacy(pubCornerPointsLessSharp)) {
+    sensor_msgs::PointCloud2 cornerPointsLessSharpMsg;
+    pcl::toROSMsg(features.corner_less_sharp, cornerPointsLessSharpMsg);
+    cornerPointsLessSharpMsg.header.stamp = header.stamp;
+    cornerPointsLessSharpMsg.header.frame_id = "/aft_mapped";
+    PublishTracked(pubCornerPointsLessSharp, cornerPointsLessSharpMsg);
+  }
 
-  pcl::PointCloud<PointType>::Ptr laserCloud(new pcl::PointCloud<PointType>());
-  for (int i = 0; i < N_SCANS; i++) {
-    scanStartInd[i] = laserCloud->size() + 5;
-    *laserCloud += laserCloudScans[i];
-    scanEndInd[i] = laserCloud->size() - 6;
-    // ROS_INFO("scan %d start-end [%d, %d]", i, scanStartInd[i],
-    // scanEndInd[i]);
+  if (legacy(pubSurfPointsFlat)) {
+    sensor_msgs::PointCloud2 surfPointsFlat2;
+    pcl::toROSMsg(features.surf_flat, surfPointsFlat2);
+    surfPointsFlat2.header.stamp = header.stamp;
+    surfPointsFlat2.header.frame_id = "/aft_mapped";
+    PublishTracked(pubSurfPointsFlat, surfPointsFlat2);
   }
 
-  printf("prepare time %f \n", t_prepare.toc());
+  if (legacy(pubSurfPointsLessFlat)) {
+    sensor_msgs::PointCloud2 surfPointsLessFlat2;
+    pcl::toROSMsg(features.surf_less_flat, surfPointsLessFlat2);
+    surfPointsLessFlat2.header.stamp = header.stamp;
+    surfPointsLessFlat2.header.frame_id = "/aft_mapped";
+    PublishTracked(pubSurfPointsLessFlat, surfPointsLessFlat2);
+  }
 
-  int kNumCurvSize = 5;
-  constexpr int kNumRegion = 50;       // 6
-  constexpr int kNumEdge = 2;          // 2
-  constexpr int kNumFlat = 4;          // 4
-  constexpr int kNumEdgeNeighbor = 5;  // 5;
-  constexpr int kNumFlatNeighbor = 5;  // 5;
-  float kThresholdSharp = 50;          // 0.1;
-  float kThresholdFlat = 30;           // 0.1;
-  constexpr float kThresholdLessflat = 0.1;
-
-  constexpr float kDistanceFaraway = 25;
-  for (int i = 5; i < cloudSize - 5; i++) {
-    float dis = sqrt(laserCloud->points[i].x * laserCloud->points[i].x +
-                     laserCloud->points[i].y * laserCloud->points[i].y +
-                     laserCloud->points[i].z * laserCloud->points[i].z);
-    if (dis > kDistanceFaraway) {
-      kNumCurvSize = 2;
-    }
-    float diffX = 0, diffY = 0, diffZ = 0;
-    for (int j = 1; j <= kNumCurvSize; ++j) {
-      diffX += laserCloud->points[i - j].x + laserCloud->points[i + j].x;
-      diffY += laserCloud->points[i - j].y + laserCloud->points[i + j].y;
-      diffZ += laserCloud->points[i - j].z + laserCloud->points[i + j].z;
-    }
-    diffX -= 2 * kNumCurvSize * laserCloud->points[i].x;
-    diffY -= 2 * kNumCurvSize * laserCloud->points[i].y;
-    diffZ -= 2 * kNumCurvSize * laserCloud->points[i].z;
-    /*
-    float diffX = laserCloud->points[i - 5].x + laserCloud->points[i - 4].x +
-                  laserCloud->points[i - 3].x + laserCloud->points[i - 2].x +
-                  laserCloud->points[i - 1].x - 10 * laserCloud->points[i].x +
-                  laserCloud->points[i + 1].x + laserCloud->points[i + 2].x +
-                  laserCloud->points[i + 3].x + laserCloud->points[i + 4].x +
-                  laserCloud->points[i + 5].x;
-    float diffY = laserCloud->points[i - 5].y + laserCloud->points[i - 4].y +
-                  laserCloud->points[i - 3].y + laserCloud->points[i - 2].y +
-                  laserCloud->points[i - 1].y - 10 * laserCloud->points[i].y +
-                  laserCloud->points[i + 1].y + laserCloud->points[i + 2].y +
-                  laserCloud->points[i + 3].y + laserCloud->points[i + 4].y +
-                  laserCloud->points[i + 5].y;
-    float diffZ = laserCloud->points[i - 5].z + laserCloud->points[i - 4].z +
-                  laserCloud->points[i - 3].z + laserCloud->points[i - 2].z +
-                  laserCloud->points[i - 1].z - 10 * laserCloud->points[i].z +
-                  laserCloud->points[i + 1].z + laserCloud->points[i + 2].z +
-                  laserCloud->points[i + 3].z + laserCloud->points[i + 4].z +
-                  laserCloud->points[i + 5].z;
-                  */
-
-    float tmp2 = diffX * diffX + diffY * diffY + diffZ * diffZ;
-    float tmp = sqrt(tmp2);
-
-    cloudCurvature[i] = tmp2;
-    if (b_normalize_curv) {
-      /// use normalized curvature
-      cloudCurvature[i] = tmp / (2 * kNumCurvSize * dis + 1e-3);
-    }
-    cloudSortInd[i] = i;
-    cloudNeighborPicked[i] = 0;
-    cloudLabel[i] = 0;
-
-    /// Mark un-reliable points
-    constexpr float kMaxFeatureDis = 1e4;
-    if (fabs(dis) > kMaxFeatureDis || fabs(dis) < 1e-4 || !std::isfinite(dis)) {
-      cloudLabel[i] = 99;
-      cloudNeighborPicked[i] = 1;
+  // pub each scam, the lines are consecutive slices of the full cloud
+  if (PUB_EACH_LINE) {
+    const uint32_t step = laserCloudOutMsg.point_step;
+    uint32_t offset = 0;
+    for (int i = 0; i < N_SCANS; i++) {
+      const uint32_t line_start = offset;
+      offset += line_size[i];
+      if (!HasSubscribers(pubEachScan[i])) continue;
+
+      sensor_msgs::PointCloud2 scanMsg;
+      scanMsg.header = laserCloudOutMsg.header;
+      scanMsg.height = 1;
+      scanMsg.width = line_size[i];
+      scanMsg.fields = laserCloudOutMsg.fields;
+      scanMsg.is_bigendian = laserCloudOutMsg.is_bigendian;
+      scanMsg.point_step = step;
+      scanMsg.row_step = step * line_size[i];
+      scanMsg.is_dense = laserCloudOutMsg.is_dense;
+      auto begin = laserCloudOutMsg.data.begin() + line_start * step;
+      scanMsg.data.assign(begin, begin + scanMsg.row_step);
+      pubEachScan[i].publish(scanMsg);
     }
   }
 
-  for (int i = 5; i < cloudSize - 6; i++) {
-    float diffX = laserCloud->points[i + 1].x - laserCloud->points[i].x;
-    float diffY = laserCloud->points[i + 1].y - laserCloud->points[i].y;
-    float diffZ = laserCloud->points[i + 1].z - laserCloud->points[i].z;
-    float diff = diffX * diffX + diffY * diffY + diffZ * diffZ;
-
-    float diffX2 = laserCloud->points[i].x - laserCloud->points[i - 1].x;
-    float diffY2 = laserCloud->points[i].y - laserCloud->points[i - 1].y;
-    float diffZ2 = laserCloud->points[i].z - laserCloud->points[i - 1].z;
-    float diff2 = diffX2 * diffX2 + diffY2 * diffY2 + diffZ2 * diffZ2;
-    float dis = laserCloud->points[i].x * laserCloud->points[i].x +
-                laserCloud->points[i].y * laserCloud->points[i].y +
-                laserCloud->points[i].z * laserCloud->points[i].z;
-
-    if (diff > 0.00015 * dis && diff2 > 0.00015 * dis) {
-      cloudNeighborPicked[i] = 1;
-    }
+  printf("scan registration time %f ms *************\n", t_whole->toc());
+  LogUnconsumedBytes();
+
+  /// Quotas for the next frame
+  if (budget) {
+    budget->ReportExtraction(extraction_ms);
+    const FeatureQuota &quota = budget->Update();
+    extractor.set_quota(quota);
+
+    loam_horizon::FeatureQuota quotaMsg;
+    quotaMsg.header.stamp = header.stamp;
+    quotaMsg.latency_ms = budget->latency_ms();
+    quotaMsg.target_ms = budget_config.target_ms;
+    quotaMsg.num_edge = quota.num_edge;
+    quotaMsg.num_less_edge = quota.num_less_edge;
+    quotaMsg.num_flat = quota.num_flat;
+    PublishTracked(pubFeatureQuota, quotaMsg);
   }
+  if (t_whole->toc() > 100) ROS_WARN("scan registration process over 100ms");
+}
 
-  TicToc t_pts;
+/// Counts a frame towards the start-up delay, true once frames are processed
+bool FrameInited() {
+  if (!systemInited) {
+    systemInitCount++;
+    if (systemInitCount >= systemDelay) systemInited = true;
+  }
+  return systemInited;
+}
 
-  pcl::PointCloud<PointType> cornerPointsSharp;
-  pcl::PointCloud<PointType> cornerPointsLessSharp;
-  pcl::PointCloud<PointType> surfPointsFlat;
-  pcl::PointCloud<PointType> surfPointsLessFlat;
+void laserCloudHandler(const sensor_msgs::PointCloud2ConstPtr &laserCloudMsg) {
+  if (!FrameInited()) return;
 
-  if (b_normalize_curv) {
-    kThresholdFlat = THRESHOLD_FLAT;
-    kThresholdSharp = THRESHOLD_SHARP;
-  }
+  TicToc t_whole;
+  TicToc t_prepare;
+  IngestScan(*laserCloudMsg, MINIMUM_RANGE, laserCloud.get(), &line_size);
+  printf("points size %lu \n", laserCloud->size());
+
+  printf("prepare time %f \n", t_prepare.toc());
 
-  float t_q_sort = 0;
-  for (int i = 0; i < N_SCANS; i++) {
-    if (scanEndInd[i] - scanStartInd[i] < kNumCurvSize) continue;
-    pcl::PointCloud<PointType>::Ptr surfPointsLessFlatScan(
-        new pcl::PointCloud<PointType>);
+  TicToc t_pts;
+  extractor.Extract(laserCloud->points.data(), line_size, &features);
+  printf("sort q time %f \n", extractor.sort_time());
+  printf("seperate points time %f \n", t_pts.toc());
 
-    /// debug
-    if (b_only_1_scan && i > 0) {
-      break;
+  PublishFrame(laserCloudMsg->header, &t_whole);
+}
+
+/// Streaming mode: the driver packets are fed to the extractor as they
+/// arrive. A frame holds the points timed in [stream_timebase,
+/// stream_timebase + scanPeriod) and closes at the first point past it, the
+/// frames follow each other on that grid. Points get the fields IngestScan
+/// would give them, the time in the intensity is relative to the frame
+/// start over scanPeriod and stays below 1.
+bool STREAM_EXTRACTION = false;
+bool stream_started = false;
+/// Whether the frame being streamed goes to the extractor, not during the
+/// start-up delay
+bool stream_extracting = false;
+uint64_t stream_timebase = 0;
+
+/// Only the line ends and the features are left to do
+void FinishStreamFrame() {
+  TicToc t_whole;
+  TicToc t_pts;
+  extractor.FinishFrame(laserCloud.get(), &line_size, &features);
+  printf("points size %lu \n", laserCloud->size());
+  printf("sort q time %f \n", extractor.sort_time());
+  printf("finish frame time %f \n", t_pts.toc());
+
+  if (BUILD_RANGE_IMAGE) {
+    range_image.Reset(laserCloud->size());
+    for (size_t i = 0; i < laserCloud->size(); i++) {
+      range_image.Insert(laserCloud->points[i], i);
     }
+  }
+
+  std_msgs::Header header;
+  header.stamp.fromNSec(stream_timebase);
+  PublishFrame(header, &t_whole);
+}
 
-    for (int j = 0; j < kNumRegion; j++) {
-      int sp =
-          scanStartInd[i] + (scanEndInd[i] - scanStartInd[i]) * j / kNumRegion;
-      int ep = scanStartInd[i] +
-               (scanEndInd[i] - scanStartInd[i]) * (j + 1) / kNumRegion - 1;
-      //      ROS_INFO("scan [%d], id from-to [%d-%d] in [%d-%d]", i, sp, ep,
-      //               scanStartInd[i], scanEndInd[i]);
-
-      TicToc t_tmp;
-      //      std::sort(cloudSortInd + sp, cloudSortInd + ep + 1, comp);
-      // sort the curvatures from small to large
-      for (int k = sp + 1; k <= ep; k++) {
-        for (int l = k; l >= sp + 1; l--) {
-          if (cloudCurvature[cloudSortInd[l]] <
-              cloudCurvature[cloudSortInd[l - 1]]) {
-            int temp = cloudSortInd[l - 1];
-            cloudSortInd[l - 1] = cloudSortInd[l];
-            cloudSortInd[l] = temp;
-          }
-        }
-      }
-
-      float SumCurRegion = 0.0;
-      float MaxCurRegion = cloudCurvature[cloudSortInd[ep]];  //the largest curvature in sp ~ ep
-      for (int k = ep - 1; k >= sp; k--) {
-        SumCurRegion += cloudCurvature[cloudSortInd[k]];
-      }
-
-      if (MaxCurRegion > 3 * SumCurRegion)
-        cloudNeighborPicked[cloudSortInd[ep]] = 1;
-
-      t_q_sort += t_tmp.toc();
-
-      if (true) {
-        for (int tt = sp; tt < ep - 1; ++tt) {
-          ROS_ASSERT(cloudCurvature[cloudSortInd[tt]] <=
-                     cloudCurvature[cloudSortInd[tt + 1]]);
-        }
-      }
-
-      int largestPickedNum = 0;
-      for (int k = ep; k >= sp; k--) {
-        int ind = cloudSortInd[k];
-
-        if (cloudNeighborPicked[ind] != 0) continue;
-
-        if (cloudCurvature[ind] > kThresholdSharp) {
-          largestPickedNum++;
-          if (largestPickedNum <= kNumEdge) {
-            cloudLabel[ind] = 2;
-            cornerPointsSharp.push_back(laserCloud->points[ind]);
-            cornerPointsLessSharp.push_back(laserCloud->points[ind]);
-            // ROS_INFO("pick sharp at sort_id [%d], primary id[%d]", k, ind);
-            // if (ind == 211 || ind == 212 || ind == 213 || ind == 214) {
-            //   const auto &pt = laserCloud->points[ind];
-            //   printf("%d-[%f, %f, %f]\n", ind, pt.x, pt.y, pt.z);
-            // }
-          } else if (largestPickedNum <= 20) {
-            cloudLabel[ind] = 1;
-            cornerPointsLessSharp.push_back(laserCloud->points[ind]);
-          } else {
-            break;
-          }
-
-          cloudNeighborPicked[ind] = 1;
-
-          for (int l = 1; l <= kNumEdgeNeighbor; l++) {
-            float diffX = laserCloud->points[ind + l].x -
-                          laserCloud->points[ind + l - 1].x;
-            float diffY = laserCloud->points[ind + l].y -
-                          laserCloud->points[ind + l - 1].y;
-            float diffZ = laserCloud->points[ind + l].z -
-                          laserCloud->points[ind + l - 1].z;
-            if (diffX * diffX + diffY * diffY + diffZ * diffZ > 0.02) {
-              break;
-            }
-
-            cloudNeighborPicked[ind + l] = 1;
-          }
-          for (int l = -1; l >= -kNumEdgeNeighbor; l--) {
-            float diffX = laserCloud->points[ind + l].x -
-                          laserCloud->points[ind + l + 1].x;
-            float diffY = laserCloud->points[ind + l].y -
-                          laserCloud->points[ind + l + 1].y;
-            float diffZ = laserCloud->points[ind + l].z -
-                          laserCloud->points[ind + l + 1].z;
-            if (diffX * diffX + diffY * diffY + diffZ * diffZ > 0.02) {
-              break;
-            }
-
-            cloudNeighborPicked[ind + l] = 1;
-          }
-        }
-      }
-
-      int smallestPickedNum = 0;
-      for (int k = sp; k <= ep; k++) {
-        int ind = cloudSortInd[k];
-
-        if (cloudNeighborPicked[ind] != 0) continue;
-
-        if (cloudCurvature[ind] < kThresholdFlat) {
-          cloudLabel[ind] = -1;
-          surfPointsFlat.push_back(laserCloud->points[ind]);
-          cloudNeighborPicked[ind] = 1;
-
-          smallestPickedNum++;
-          if (smallestPickedNum >= kNumFlat) {
-            break;
-          }
-
-          for (int l = 1; l <= kNumFlatNeighbor; l++) {
-            float diffX = laserCloud->points[ind + l].x -
-                          laserCloud->points[ind + l - 1].x;
-            float diffY = laserCloud->points[ind + l].y -
-                          laserCloud->points[ind + l - 1].y;
-            float diffZ = laserCloud->points[ind + l].z -
-                          laserCloud->points[ind + l - 1].z;
-            if (diffX * diffX + diffY * diffY + diffZ * diffZ > 0.02) {
-              break;
-            }
-
-            cloudNeighborPicked[ind + l] = 1;
-          }
-          for (int l = -1; l >= -kNumFlatNeighbor; l--) {
-            float diffX = laserCloud->points[ind + l].x -
-                          laserCloud->points[ind + l + 1].x;
-            float diffY = laserCloud->points[ind + l].y -
-                          laserCloud->points[ind + l + 1].y;
-            float diffZ = laserCloud->points[ind + l].z -
-                          laserCloud->points[ind + l + 1].z;
-            if (diffX * diffX + diffY * diffY + diffZ * diffZ > 0.02) {
-              break;
-            }
-
-            cloudNeighborPicked[ind + l] = 1;
-          }
-        }
-      }
-
-      for (int k = sp; k <= ep; k++) {
-        if (cloudLabel[k] <= 0 && cloudCurvature[k] < kThresholdLessflat) {
-          surfPointsLessFlatScan->push_back(laserCloud->points[k]);
-        }
-      }
+void livoxPacketHandler(const livox_ros_driver::CustomMsgConstPtr &packet) {
+  const uint64_t period_ns = scanPeriod * 1e9;
+  const float thres2 = MINIMUM_RANGE * MINIMUM_RANGE;
+  for (const auto &p : packet->points) {
+    const uint64_t t = packet->timebase + p.offset_time;
+    if (!stream_started || t < stream_timebase ||
+        t >= stream_timebase + period_ns) {
+      if (stream_extracting) FinishStreamFrame();
+      /// The next frame on the grid, or one starting at t after a gap or a
+      /// jump back of the time
+      const uint64_t next = stream_timebase + period_ns;
+      stream_timebase =
+          stream_started && t >= next && t < next + period_ns ? next : t;
+      stream_started = true;
+      stream_extracting = FrameInited();
+      if (stream_extracting) extractor.BeginFrame(N_SCANS);
     }
+    if (!stream_extracting) continue;
 
-    surfPointsLessFlat += surfPointsFlat;
-    cornerPointsLessSharp += cornerPointsSharp;
-    /// Whether downsample less-flat points
-    if (false) {
-      pcl::PointCloud<PointType> surfPointsLessFlatScanDS;
-      pcl::VoxelGrid<PointType> downSizeFilter;
-      downSizeFilter.setInputCloud(surfPointsLessFlatScan);
-      downSizeFilter.setLeafSize(0.2, 0.2, 0.2);
-      downSizeFilter.filter(surfPointsLessFlatScanDS);
-      surfPointsLessFlat += surfPointsLessFlatScanDS;
-    } else {
-      surfPointsLessFlat += *surfPointsLessFlatScan;
+    if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) {
+      continue;
     }
+    if (p.x * p.x + p.y * p.y + p.z * p.z < thres2) continue;
+    if (p.line >= N_SCANS) continue;
+
+    PointType point;
+    point.x = p.x;
+    point.y = p.y;
+    point.z = p.z;
+    const double s = (t - stream_timebase) * 1e-9 / scanPeriod;
+    point.intensity = p.line + s * 0.1;
+    point.curvature = p.reflectivity * 0.1;
+    point.normal_x = point.normal_y = point.normal_z = 0;
+    extractor.AppendPoint(p.line, point);
   }
-  printf("sort q time %f \n", t_q_sort);
-  printf("seperate points time %f \n", t_pts.toc());
+  if (stream_extracting) extractor.Update();
+}
 
-  if (false) {
-    removeClosedPointCloud(*laserCloud, *laserCloud, MINIMUM_RANGE);
-    removeClosedPointCloud(cornerPointsLessSharp, cornerPointsLessSharp,
-                           MINIMUM_RANGE);
-    removeClosedPointCloud(cornerPointsSharp, cornerPointsSharp, MINIMUM_RANGE);
-    removeClosedPointCloud(surfPointsFlat, surfPointsFlat, MINIMUM_RANGE);
-    removeClosedPointCloud(surfPointsLessFlat, surfPointsLessFlat,
-                           MINIMUM_RANGE);
+/// Stream mode reads the driver itself, so none of what livox_repub and the
+/// IMU undistortion do to the points happens. Refuses what it cannot do
+/// without them, warns of the settings it ignores.
+bool CheckStreamConfig(ros::NodeHandle &nh, int num_lidars) {
+  if (num_lidars > 1) {
+    ROS_ERROR("stream_extraction reads one lidar, %d need livox_repub",
+              num_lidars);
+    return false;
   }
-
-  /// Visualize curvature
-  if (b_viz_curv) {
-    std_msgs::Header ros_hdr = laserCloudMsg->header;
-    ros_hdr.frame_id = "/aft_mapped";
-    VisualizeCurvature(cloudCurvature, cloudLabel, *laserCloud, ros_hdr);
+  std::string capture_file;
+  nh.param<std::string>("capture_file", capture_file, "");
+  if (!capture_file.empty()) {
+    ROS_ERROR("stream_extraction reads /livox/lidar, a capture replay is "
+              "only published by livox_repub");
+    return false;
   }
-
-  sensor_msgs::PointCloud2 laserCloudOutMsg;
-  pcl::toROSMsg(*laserCloud, laserCloudOutMsg);
-  laserCloudOutMsg.header.stamp = laserCloudMsg->header.stamp;
-  laserCloudOutMsg.header.frame_id = "/aft_mapped";
-  pubLaserCloud.publish(laserCloudOutMsg);
-
-  sensor_msgs::PointCloud2 cornerPointsSharpMsg;
-  pcl::toROSMsg(cornerPointsSharp, cornerPointsSharpMsg);
-  cornerPointsSharpMsg.header.stamp = laserCloudMsg->header.stamp;
-  cornerPointsSharpMsg.header.frame_id = "/aft_mapped";
-  pubCornerPointsSharp.publish(cornerPointsSharpMsg);
-
-  sensor_msgs::PointCloud2 cornerPointsLessSharpMsg;
-  pcl::toROSMsg(cornerPointsLessSharp, cornerPointsLessSharpMsg);
-  cornerPointsLessSharpMsg.header.stamp = laserCloudMsg->header.stamp;
-  cornerPointsLessSharpMsg.header.frame_id = "/aft_mapped";
-  pubCornerPointsLessSharp.publish(cornerPointsLessSharpMsg);
-
-  sensor_msgs::PointCloud2 surfPointsFlat2;
-  pcl::toROSMsg(surfPointsFlat, surfPointsFlat2);
-  surfPointsFlat2.header.stamp = laserCloudMsg->header.stamp;
-  surfPointsFlat2.header.frame_id = "/aft_mapped";
-  pubSurfPointsFlat.publish(surfPointsFlat2);
-
-  sensor_msgs::PointCloud2 surfPointsLessFlat2;
-  pcl::toROSMsg(surfPointsLessFlat, surfPointsLessFlat2);
-  surfPointsLessFlat2.header.stamp = laserCloudMsg->header.stamp;
-  surfPointsLessFlat2.header.frame_id = "/aft_mapped";
-  pubSurfPointsLessFlat.publish(surfPointsLessFlat2);
-
-  // pub each scam
-  if (PUB_EACH_LINE) {
-    for (int i = 0; i < N_SCANS; i++) {
-      sensor_msgs::PointCloud2 scanMsg;
-      pcl::toROSMsg(laserCloudScans[i], scanMsg);
-      scanMsg.header.stamp = laserCloudMsg->header.stamp;
-      scanMsg.header.frame_id = "/aft_mapped";
-      pubEachScan[i].publish(scanMsg);
-    }
+  int frame_window_ms, point_budget, tag_mask, min_reflectivity;
+  double blind;
+  std::vector<double> box, fov;
+  nh.param<int>("frame_window_ms", frame_window_ms, 0);
+  nh.param<int>("point_budget", point_budget, 0);
+  nh.param<int>("filter_tag_mask", tag_mask, 0);
+  nh.param<int>("filter_min_reflectivity", min_reflectivity, 0);
+  nh.param<double>("filter_blind", blind, 0);
+  nh.param<std::vector<double>>("filter_box", box, {});
+  nh.param<std::vector<double>>("filter_fov_deg", fov, {});
+  if (frame_window_ms > 0) {
+    ROS_WARN("stream_extraction ignores frame_window_ms, frames are %.0f ms",
+             scanPeriod * 1e3);
   }
+  if (point_budget > 0) ROS_WARN("stream_extraction ignores point_budget");
+  if (tag_mask || min_reflectivity || blind > 0 || !box.empty() ||
+      !fov.empty()) {
+    ROS_WARN("stream_extraction ignores the livox_repub filter_* settings");
+  }
+  ROS_WARN("stream_extraction: the points are not undistorted by the IMU");
+  return true;
+}
 
-  printf("scan registration time %f ms *************\n", t_whole.toc());
-  if (t_whole.toc() > 100) ROS_WARN("scan registration process over 100ms");
+void laserOdometryTimeHandler(const std_msgs::Float64ConstPtr &time_ms) {
+  if (budget) budget->ReportOdometry(time_ms->data);
+}
+
+void laserMappingTimeHandler(const std_msgs::Float64ConstPtr &time_ms) {
+  if (budget) budget->ReportMapping(time_ms->data);
 }
 
 int main(int argc, char **argv) {
@@ -717,16 +481,78 @@ int main(int argc, char **argv) {
   nh.param<int>("scan_line", N_SCANS, 6); // Horizon has 6 scan lines
   nh.param<double>("threshold_flat", THRESHOLD_FLAT, 0.01);
   nh.param<double>("threshold_sharp", THRESHOLD_SHARP, 0.01);
+  nh.param<double>("minimum_range", MINIMUM_RANGE, 0.1);
+  int feature_threads;
+  nh.param<int>("feature_threads", feature_threads, 1);
+  nh.param<bool>("compact_features", COMPACT_FEATURES, false);
+  nh.param<bool>("range_image", BUILD_RANGE_IMAGE, false);
+  nh.param<bool>("point_normals", POINT_NORMALS, false);
+  nh.param<bool>("stream_extraction", STREAM_EXTRACTION, false);
+  bool ground_segmentation;
+  GroundSegmenterConfig ground_config;
+  nh.param<bool>("ground_segmentation", ground_segmentation, false);
+  nh.param<float>("ground_max_slope_deg", ground_config.max_slope_deg, 10);
+  nh.param<float>("ground_max_z", ground_config.max_z, 0);
+  nh.param<int>("max_ground_flat", ground_config.max_ground_flat, 200);
+  if (ground_segmentation) {
+    ground_segmenter.reset(new GroundSegmenter(ground_config));
+  }
+  /// Cross-line neighbors of the normals and the ground test come from the
+  /// range image
+  BUILD_RANGE_IMAGE =
+      BUILD_RANGE_IMAGE || POINT_NORMALS || ground_segmentation;
+  bool feature_budget;
+  nh.param<bool>("feature_budget", feature_budget, false);
+  nh.param<double>("latency_target_ms", budget_config.target_ms, 60);
+  nh.param<int>("min_num_edge", budget_config.min_quota.num_edge, 1);
+  nh.param<int>("max_num_edge", budget_config.max_quota.num_edge, 4);
+  nh.param<int>("min_num_less_edge", budget_config.min_quota.num_less_edge, 8);
+  nh.param<int>("max_num_less_edge", budget_config.max_quota.num_less_edge,
+                40);
+  nh.param<int>("min_num_flat", budget_config.min_quota.num_flat, 2);
+  nh.param<int>("max_num_flat", budget_config.max_quota.num_flat, 8);
 
   printf("scan line number %d \n", N_SCANS);
 
-  if (N_SCANS != 6) {
-    printf("only support livox horizon lidar!");
+  FeatureExtractorConfig extractor_config;
+  extractor_config.threshold_flat = THRESHOLD_FLAT;
+  extractor_config.threshold_sharp = THRESHOLD_SHARP;
+  extractor_config.num_threads = feature_threads;
+  nh.param<bool>("downsample_less_flat", extractor_config.downsample_less_flat,
+                 false);
+  nh.param<float>("less_flat_leaf_size", extractor_config.less_flat_leaf_size,
+                  0.2);
+  nh.param<bool>("specialized_kernels", extractor_config.specialized_kernels,
+                 true);
+  extractor.set_config(extractor_config);
+  if (feature_budget) {
+    budget.reset(
+        new FeatureBudgetController(budget_config, extractor_config.quota));
+  }
+
+  /// livox_repub numbers the lines of lidar k from k * lidar_lines
+  std::vector<std::string> lidar_topics;
+  int lidar_lines;
+  nh.param<std::vector<std::string>>("lidar_topics", lidar_topics,
+                                     {"/livox/lidar"});
+  nh.param<int>("lidar_lines", lidar_lines, 6);
+  const int num_lidars = std::max<int>(lidar_topics.size(), 1);
+  if (N_SCANS != num_lidars * lidar_lines) {
+    ROS_ERROR("scan_line is %d, %d lidars of %d lines need %d", N_SCANS,
+              num_lidars, lidar_lines, num_lidars * lidar_lines);
     return 0;
   }
 
-  ros::Subscriber subLaserCloud = nh.subscribe<sensor_msgs::PointCloud2>(
-      "/livox_undistort", 100, laserCloudHandler);
+  /// The packets bypass livox_repub and the IMU undistortion
+  ros::Subscriber subLaserCloud;
+  if (STREAM_EXTRACTION && !CheckStreamConfig(nh, num_lidars)) return 0;
+  if (STREAM_EXTRACTION) {
+    subLaserCloud = nh.subscribe<livox_ros_driver::CustomMsg>(
+        "/livox/lidar", 100, livoxPacketHandler);
+  } else {
+    subLaserCloud = nh.subscribe<sensor_msgs::PointCloud2>(
+        "/livox_undistort", 100, laserCloudHandler);
+  }
 
   pubLaserCloud =
       nh.advertise<sensor_msgs::PointCloud2>("/velodyne_cloud_2", 100);
@@ -746,8 +572,24 @@ int main(int argc, char **argv) {
   pubRemovePoints =
       nh.advertise<sensor_msgs::PointCloud2>("/laser_remove_points", 100);
 
+  pubFeatureCloud =
+      nh.advertise<loam_horizon::FeatureCloud>("/laser_feature_cloud", 100);
+
+  pubFeatureQuota =
+      nh.advertise<loam_horizon::FeatureQuota>("/feature_quota", 100);
+
+  /// Only the budget listens to the stage times, subscribed they would be
+  /// published for nobody on every frame
+  ros::Subscriber subOdometryTime, subMappingTime;
+  if (feature_budget) {
+    subOdometryTime = nh.subscribe<std_msgs::Float64>(
+        "/laser_odometry_time", 100, laserOdometryTimeHandler);
+    subMappingTime = nh.subscribe<std_msgs::Float64>(
+        "/laser_mapping_time", 100, laserMappingTimeHandler);
+  }
+
   pub_curvature =
-      nh.advertise<visualization_msgs::MarkerArray>("/curvature", 100);
+      nh.advertise<sensor_msgs::PointCloud2>("/curvature", 100);
 
   if (PUB_EACH_LINE) {
     for (int i = 0; i < N_SCANS; i++) {
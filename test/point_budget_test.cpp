@@ -0,0 +1,51 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <vector>
+#include "loam_horizon/point_budget.h"
+
+namespace {
+
+/// Feeds budget the points of a Horizon at 240k points/s over 6 lines, in
+/// packets of 1 ms, and updates it at each frame of window_ms sliding by
+/// stride_ms as livox_repub does: a frame is stamped with its start and
+/// published once the points reach its end. Returns the points kept per
+/// second after a second of warm-up.
+double KeptRate(PointRateBudget* budget, uint64_t window_ms,
+                uint64_t stride_ms) {
+  const uint64_t kMs = 1000000;
+  const int kPointsPerPacket = 240, kLines = 6;
+  const uint64_t warm_up = 1000 * kMs, end = 11000 * kMs;
+  uint64_t frame_start = 0, kept = 0;
+  for (uint64_t t = 0; t < end; t += kMs) {
+    for (int i = 0; i < kPointsPerPacket; ++i) {
+      if (budget->Keep(i % kLines) && t >= warm_up) kept++;
+    }
+    while (frame_start + window_ms * kMs <= t + kMs) {
+      budget->Update(frame_start);
+      frame_start += stride_ms * kMs;
+    }
+  }
+  return kept / ((end - warm_up) * 1e-9);
+}
+
+TEST(PointRateBudget, KeepsTheBudgetOfOverlappingFrames) {
+  PointRateBudget budget;
+  budget.points_per_second = 60000;
+  /// Each point falls in 4 frames
+  EXPECT_NEAR(KeptRate(&budget, 100, 25), 60000, 600);
+  EXPECT_NEAR(budget.offered_rate, 240000, 2400);
+}
+
+TEST(PointRateBudget, KeepsTheBudgetOfAdjacentFrames) {
+  PointRateBudget budget;
+  budget.points_per_second = 60000;
+  EXPECT_NEAR(KeptRate(&budget, 100, 100), 60000, 600);
+}
+
+TEST(PointRateBudget, KeepsEveryPointUnderTheBudget) {
+  PointRateBudget budget;
+  budget.points_per_second = 300000;
+  EXPECT_EQ(KeptRate(&budget, 100, 25), 240000);
+}
+
+}  // namespace